@@ -0,0 +1,117 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own includes
+#include "ByteQueue.h"
+
+// System includes
+#include <string.h>
+
+ByteQueue::ByteQueue(int capacity, QObject* parent)
+    : QObject(parent)
+    , _writePosition(0)
+    , _readPosition(0)
+    , _readPending(0)
+    , _writeWaiting(0)
+{
+    int size = 1;
+    while (size < capacity)
+        size <<= 1;
+
+    _buffer = new char[size];
+    _mask = size - 1;
+}
+
+ByteQueue::~ByteQueue()
+{
+    delete[] _buffer;
+}
+
+int ByteQueue::freeSpace() const
+{
+    return capacity() - int(_writePosition.loadAcquire() - _readPosition.loadAcquire());
+}
+
+int ByteQueue::size() const
+{
+    return int(_writePosition.loadAcquire() - _readPosition.loadAcquire());
+}
+
+int ByteQueue::write(const char* data, int length)
+{
+    const quint32 writePosition = _writePosition.load();
+    int space = capacity() - int(writePosition - _readPosition.loadAcquire());
+
+    if (space < length)
+    {
+        // ask to be told when the consumer has made room.  the consumer may
+        // have read everything before it saw the request, so look again
+        _writeWaiting.fetchAndStoreOrdered(1);
+        space = capacity() - int(writePosition - _readPosition.loadAcquire());
+    }
+
+    const int count = qMin(space, length);
+    if (count == 0)
+        return 0;
+
+    // copy in up to two pieces, around the end of the ring
+    const int start = writePosition & _mask;
+    const int first = qMin(count, capacity() - start);
+    memcpy(_buffer + start, data, first);
+    memcpy(_buffer, data + first, count - first);
+
+    _writePosition.storeRelease(writePosition + count);
+
+    if (_readPending.fetchAndStoreOrdered(1) == 0)
+        emit dataAvailable();
+
+    return count;
+}
+
+int ByteQueue::readAvailable(char* data, int length)
+{
+    const quint32 readPosition = _readPosition.load();
+    const int count = qMin(length, int(_writePosition.loadAcquire() - readPosition));
+    if (count == 0)
+        return 0;
+
+    const int start = readPosition & _mask;
+    const int first = qMin(count, capacity() - start);
+    memcpy(data, _buffer + start, first);
+    memcpy(data + first, _buffer, count - first);
+
+    _readPosition.storeRelease(readPosition + count);
+    return count;
+}
+
+int ByteQueue::read(char* data, int length)
+{
+    int count = readAvailable(data, length);
+
+    if (count < length)
+    {
+        // the queue is empty, so writes from now on need a new notification.
+        // data written before the request was withdrawn is read here
+        _readPending.fetchAndStoreOrdered(0);
+        count += readAvailable(data + count, length - count);
+    }
+
+    if (count > 0 && _writeWaiting.fetchAndStoreOrdered(0) == 1)
+        emit spaceAvailable();
+
+    return count;
+}
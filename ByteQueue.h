@@ -0,0 +1,106 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#pragma once
+
+// Qt includes
+#include <QAtomicInteger>
+#include <QObject>
+
+/**
+ * A fixed size queue of bytes passed from one thread to another.
+ *
+ * The queue is a ring buffer with a single producer, which calls write(),
+ * and a single consumer, which calls read().  Each side only advances its
+ * own position in the ring, so neither needs a lock.
+ *
+ * The producer is told through dataAvailable() that there is something to
+ * read, and the consumer through spaceAvailable() that a write which did
+ * not fit can be retried.  Each signal is emitted once until the other
+ * side has acted on it, so a busy stream does not flood the event loops
+ * of either thread.  The signals are emitted from the thread of the
+ * opposite side, and reach their receivers through queued connections.
+ */
+class ByteQueue : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * Constructs a queue which holds up to @p capacity bytes.  The capacity
+     * is rounded up to a power of two.
+     */
+    explicit ByteQueue(int capacity, QObject* parent = 0);
+    ~ByteQueue();
+
+    /** Returns the number of bytes which the queue can hold. */
+    int capacity() const { return _mask + 1; }
+
+    /**
+     * Appends up to @p length bytes of @p data to the queue and returns the
+     * number of bytes appended, which is less than @p length if the queue
+     * is full.  spaceAvailable() is then emitted once the consumer has
+     * made room.  Must only be called by the producer.
+     */
+    int write(const char* data, int length);
+
+    /**
+     * Removes up to @p length bytes from the queue into @p data and
+     * returns the number of bytes removed.  Must only be called by the
+     * consumer.
+     *
+     * dataAvailable() is only emitted again after a read() has returned
+     * less than @p length, so a consumer which stops reading earlier must
+     * come back to the queue by itself.
+     */
+    int read(char* data, int length);
+
+    /**
+     * Returns the number of bytes which can be written.  Only exact when
+     * called by the producer.
+     */
+    int freeSpace() const;
+    /**
+     * Returns the number of bytes which can be read.  Only exact when
+     * called by the consumer.
+     */
+    int size() const;
+
+signals:
+    /** Emitted by write() when data arrived which the consumer has not been told about. */
+    void dataAvailable();
+    /** Emitted by read() when the producer is waiting for room in the queue. */
+    void spaceAvailable();
+
+private:
+    // reads up to 'length' bytes without touching the notifications
+    int readAvailable(char* data, int length);
+
+    char* _buffer;
+    int _mask;
+
+    // positions of the producer and the consumer, which count up and wrap
+    // around and are only masked when indexing _buffer.  they are kept on
+    // separate cache lines so that the two threads do not contend for one.
+    alignas(64) QAtomicInteger<quint32> _writePosition;
+    alignas(64) QAtomicInteger<quint32> _readPosition;
+
+    // set when dataAvailable() was emitted, cleared by the consumer once it
+    // has emptied the queue
+    QAtomicInt _readPending;
+    // set by the producer when a write did not fit
+    QAtomicInt _writeWaiting;
+};
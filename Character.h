@@ -32,8 +32,12 @@
 // Own includes
 #include "CharacterColor.h"
 
+// System includes
+#include <string.h>
+
 // Qt includes
 #include <QHash>
+#include <QVector>
 
 typedef unsigned char LineProperty;
 
@@ -67,28 +71,26 @@ public:
    * @param _b The color used to draw the character's background.
    * @param _r A set of rendition flags which specify how this character is to be drawn.
    */
-    inline Character(quint16 _c = ' ',
+    inline Character(uint _c = ' ',
                      CharacterColor  _f = CharacterColor(COLOR_SPACE_DEFAULT,DEFAULT_FORE_COLOR),
                      CharacterColor  _b = CharacterColor(COLOR_SPACE_DEFAULT,DEFAULT_BACK_COLOR),
                      quint8  _r = DEFAULT_RENDITION)
         : character(_c), rendition(_r), foregroundColor(_f), backgroundColor(_b) {}
 
-    union
-    {
-        /** The unicode character value for this character. */
-        quint16 character;
-        /**
-     * Experimental addition which allows a single Character instance to contain more than
-     * one unicode character.
-     *
-     * charSequence is a hash code which can be used to look up the unicode
-     * character sequence in the ExtendedCharTable used to create the sequence.
-     */
-        quint16 charSequence;
-    };
+    /**
+   * The unicode character value for this character.
+   *
+   * If the RE_EXTENDED_CHAR rendition flag is set, this is instead a key
+   * which can be used to look up a sequence of unicode characters in the
+   * ExtendedCharTable of the emulation which created the sequence.
+   *
+   * The field is 24 bits wide so that it can hold any unicode code point,
+   * and shares a 32 bit word with the rendition flags.
+   */
+    quint32 character : 24;
 
     /** A combination of RENDITION flags which specify options for drawing the character. */
-    quint8  rendition;
+    quint32 rendition : 8;
 
     /** The foreground color used to draw this character. */
     CharacterColor  foregroundColor;
@@ -124,20 +126,25 @@ public:
     friend bool operator != (const Character& a, const Character& b);
 };
 
+// Character has no padding, so that characters can be compared and copied
+// as plain memory.  The image and history buffers rely on this.
+static_assert(sizeof(Character) == 12, "Character must be a packed 12 byte structure");
+
 inline bool operator == (const Character& a, const Character& b)
 { 
-    return a.character == b.character &&
-            a.rendition == b.rendition &&
-            a.foregroundColor == b.foregroundColor &&
-            a.backgroundColor == b.backgroundColor;
+    // compares the character and rendition and the colors as two words
+    quint64 headA, headB;
+    quint32 tailA, tailB;
+    memcpy(&headA, &a, sizeof(headA));
+    memcpy(&headB, &b, sizeof(headB));
+    memcpy(&tailA, reinterpret_cast<const char*>(&a) + sizeof(headA), sizeof(tailA));
+    memcpy(&tailB, reinterpret_cast<const char*>(&b) + sizeof(headB), sizeof(tailB));
+    return headA == headB && tailA == tailB;
 }
 
 inline bool operator != (const Character& a, const Character& b)
 {
-    return    a.character != b.character ||
-            a.rendition != b.rendition ||
-            a.foregroundColor != b.foregroundColor ||
-            a.backgroundColor != b.backgroundColor;
+    return !operator==(a,b);
 }
 
 inline bool Character::isTransparent(const ColorEntry* base) const
@@ -170,54 +177,119 @@ extern unsigned short vt100_graphics[32];
 
 
 /**
- * A table which stores sequences of unicode characters, referenced
- * by hash keys.  The hash key itself is the same size as a unicode
- * character ( ushort ) so that it can occupy the same space in
- * a structure.
+ * A table which stores sequences of unicode code points, such as a base
+ * character followed by combining marks, referenced by keys which fit
+ * into the character field of a Character.
+ *
+ * Each emulation owns a table which is shared by its screens.  A key is
+ * the index of its entry, so looking up a sequence is a single array
+ * access.  Identical sequences are interned and share one key.
+ *
+ * Entries are not reference counted by the cells which use them.  Instead
+ * the owner periodically marks the keys which are still used by its
+ * screens and their history between beginGarbageCollection() and
+ * endGarbageCollection(), and the entries which were not marked are
+ * reclaimed.
  */
 class ExtendedCharTable
 {
 public:
-    /** Constructs a new character table. */
+    /** Constructs a new, empty character table. */
     ExtendedCharTable();
-    ~ExtendedCharTable();
+
+    /** The longest sequence of code points which can be stored. */
+    static const int MaxSequenceLength = 8;
+    /** Returned by createExtendedChar() when a sequence cannot be stored. */
+    static const uint InvalidKey = 0xFFFFFFFF;
 
     /**
-     * Adds a sequences of unicode characters to the table and returns
-     * a hash code which can be used later to look up the sequence
+     * Adds a sequence of unicode code points to the table and returns
+     * a key which can be used later to look up the sequence
      * using lookupExtendedChar()
      *
-     * If the same sequence already exists in the table, the hash
-     * of the existing sequence will be returned.
+     * If the same sequence already exists in the table, the key
+     * of the existing sequence will be returned.  If the sequence is longer
+     * than MaxSequenceLength or the table is full, InvalidKey is returned.
+     *
+     * Keys are never 0, so that a cell holding a key cannot be mistaken
+     * for the trailing part of a wide character.
      *
-     * @param unicodePoints An array of unicode character points
+     * @param unicodePoints An array of unicode code points
      * @param length Length of @p unicodePoints
      */
-    ushort createExtendedChar(ushort* unicodePoints , ushort length);
+    uint createExtendedChar(const uint* unicodePoints , int length);
     /**
-     * Looks up and returns a pointer to a sequence of unicode characters
+     * Looks up and returns a pointer to a sequence of unicode code points
      * which was added to the table using createExtendedChar().
      *
-     * @param hash The hash key returned by createExtendedChar()
+     * @param key The key returned by createExtendedChar()
      * @param length This variable is set to the length of the
      * character sequence.
      *
-     * @return A unicode character sequence of size @p length.
+     * @return A unicode code point sequence of size @p length, which is
+     * valid until the next call to createExtendedChar() or
+     * endGarbageCollection()
+     */
+    inline const uint* lookupExtendedChar(uint key , int& length) const
+    {
+        if (key < uint(_entries.size()))
+        {
+            const QVector<uint>& sequence = _entries.at(key).sequence;
+            length = sequence.size();
+            return sequence.constData();
+        }
+        length = 0;
+        return 0;
+    }
+
+    /** Returns the number of sequences stored in the table. */
+    int count() const { return _liveCount; }
+
+    /**
+     * Returns true once enough sequences have been added since the
+     * last collection that unused entries should be reclaimed.
      */
-    ushort* lookupExtendedChar(ushort hash , ushort& length) const;
+    bool needsGarbageCollection() const { return _liveCount >= _collectThreshold; }
+    /**
+     * Starts a garbage collection.  Every key which is still in use must
+     * then be passed to markExtendedChar() before calling
+     * endGarbageCollection().
+     */
+    void beginGarbageCollection() { _generation++; }
+    /** Marks the sequence referenced by @p key as being in use. */
+    inline void markExtendedChar(uint key)
+    {
+        if (key < uint(_entries.size()))
+            _entries[key].generation = _generation;
+    }
+    /**
+     * Frees the entries which were not marked since beginGarbageCollection().  The keys of
+     * freed entries are handed out again by createExtendedChar(), for other sequences.
+     */
+    void endGarbageCollection();
+    /**
+     * Returns the number of collections which have freed entries.  When this differs between
+     * two copies of the table, a key may stand for a different sequence in each of them, so
+     * cells holding the same key cannot be assumed to show the same text.
+     */
+    quint32 collections() const { return _collections; }
 
-    /** The global ExtendedCharTable instance. */
-    static ExtendedCharTable instance;
 private:
-    // calculates the hash key of a sequence of unicode points of size 'length'
-    ushort extendedCharHash(ushort* unicodePoints , ushort length) const;
-    // tests whether the entry in the table specified by 'hash' matches the
-    // character sequence 'unicodePoints' of size 'length'
-    bool extendedCharMatch(ushort hash , ushort* unicodePoints , ushort length) const;
-    // internal, maps hash keys to character sequence buffers.  The first ushort
-    // in each value is the length of the buffer, followed by the ushorts in the buffer
-    // themselves.
-    QHash<ushort,ushort*> extendedCharTable;
+    struct Entry
+    {
+        Entry() : generation(0) {}
+
+        QVector<uint> sequence; // empty if the entry is free
+        quint32 generation;     // collection in which the entry was last marked
+    };
+
+    QVector<Entry> _entries;          // indexed by key, entry 0 is never used
+    QVector<uint> _freeKeys;          // keys of entries which can be reused
+    QHash<QVector<uint>,uint> _keys;  // interned sequences and their keys
+    quint32 _generation;
+    quint32 _collections;
+    int _liveCount;
+    int _collectThreshold;
 };
 
 Q_DECLARE_TYPEINFO(Character, Q_MOVABLE_TYPE);
@@ -30,6 +30,8 @@
 #include "konsole_wcwidth.h"
 
 // System includes
+#include <algorithm>
+#include <climits>
 #include <iostream>
 
 // Qt includes
@@ -41,8 +43,17 @@
 #include <QSharedData>
 #include <QFile>
 #include <QDesktopServices>
+#include <QElapsedTimer>
 #include <QUrl>
 
+// time in ms TerminalImageFilterChain::process() may spend scanning blocks
+#define FILTER_TIME_BUDGET 4
+
+FilterChain::FilterChain()
+    : _buffer(0)
+{
+}
+
 FilterChain::~FilterChain()
 {
     QMutableListIterator<Filter*> iter(*this);
@@ -58,10 +69,12 @@ FilterChain::~FilterChain()
 void FilterChain::addFilter(Filter* filter)
 {
     append(filter);
+    buildHotSpotIndex();
 }
 void FilterChain::removeFilter(Filter* filter)
 {
     removeAll(filter);
+    buildHotSpotIndex();
 }
 bool FilterChain::containsFilter(Filter* filter)
 {
@@ -72,37 +85,184 @@ void FilterChain::reset()
     QListIterator<Filter*> iter(*this);
     while (iter.hasNext())
         iter.next()->reset();
+
+    buildHotSpotIndex();
 }
 void FilterChain::setBuffer(const QString* buffer , const QList<int>* linePositions)
 {
+    _buffer = buffer;
+
     QListIterator<Filter*> iter(*this);
     while (iter.hasNext())
         iter.next()->setBuffer(buffer,linePositions);
 }
 void FilterChain::process()
 {
-    QListIterator<Filter*> iter(*this);
+    _matcher.update(*this);
+    processFilters(*this,_buffer);
+    buildHotSpotIndex();
+}
+void FilterChain::processFilters(const QList<Filter*>& filters , const QString* text)
+{
+    QList<Filter*> matched;
+    foreach (RegExpFilter* filter , _matcher.filters())
+        matched << filter;
+
+    bool combined = text != 0 && !matched.isEmpty();
+    foreach (Filter* filter , matched)
+    {
+        if (!filters.contains(filter))
+            combined = false;
+    }
+
+    QListIterator<Filter*> iter(filters);
     while (iter.hasNext())
-        iter.next()->process();
+    {
+        Filter* filter = iter.next();
+        if (!combined || !matched.contains(filter))
+            filter->process();
+    }
+
+    if (combined)
+        _matcher.process(*text);
 }
 void FilterChain::clear()
 {
     QList<Filter*>::clear();
+    buildHotSpotIndex();
 }
-Filter::HotSpot* FilterChain::hotSpotAt(int line , int column) const
+
+static bool spanLineLessThan(const FilterChain::HotSpotSpan& a , const FilterChain::HotSpotSpan& b)
+{
+    return a.line < b.line;
+}
+static bool spanEndsBefore(const FilterChain::HotSpotSpan& span , int column)
+{
+    return span.endColumn < column;
+}
+static bool spanStartsBefore(const FilterChain::HotSpotSpan& span , int column)
 {
+    return span.startColumn < column;
+}
+static bool columnBeforeSpan(int column , const FilterChain::HotSpotSpan& span)
+{
+    return column < span.startColumn;
+}
+
+void FilterChain::buildHotSpotIndex()
+{
+    // the spans of every hotspot on each of its lines, in the order in which
+    // hotSpotAt() prefers them where they overlap: by filter, then by hotspot
+    QVector<HotSpotSpan> spans;
+    int lineCount = 0;
+
     QListIterator<Filter*> iter(*this);
     while (iter.hasNext())
     {
-        Filter* filter = iter.next();
-        Filter::HotSpot* spot = filter->hotSpotAt(line,column);
-        if ( spot != 0 )
+        foreach (Filter::HotSpot* spot , iter.next()->hotSpots())
         {
-            return spot;
+            for (int line = qMax(0,spot->startLine()) ; line <= spot->endLine() ; line++)
+            {
+                HotSpotSpan span;
+                span.line = line;
+                span.startColumn = line == spot->startLine() ? spot->startColumn() : 0;
+                span.endColumn = line == spot->endLine() ? spot->endColumn() : INT_MAX;
+                span.hotSpot = spot;
+                spans << span;
+            }
+            lineCount = qMax(lineCount,spot->endLine() + 1);
         }
     }
+    std::stable_sort(spans.begin(),spans.end(),spanLineLessThan);
 
-    return 0;
+    _spans.resize(0);
+    _lineSpans.resize(lineCount + 1);
+
+    int nextLine = 0;
+    QVector<HotSpotSpan> pieces;
+    for (int i = 0 ; i < spans.count() ; )
+    {
+        const int line = spans[i].line;
+        const int first = _spans.count();
+        while (nextLine <= line)
+            _lineSpans[nextLine++] = first;
+
+        for ( ; i < spans.count() && spans[i].line == line ; i++)
+        {
+            // add the columns of the span which no preferred span on the
+            // line covers yet.  the spans of the line so far are sorted and
+            // do not overlap, so only the ones which overlap this span are
+            // looked at, starting with the first which ends at or after it
+            const HotSpotSpan& span = spans[i];
+            int column = span.startColumn;
+            bool covered = false;
+
+            pieces.resize(0);
+            QVector<HotSpotSpan>::const_iterator other = std::lower_bound(_spans.constBegin() + first,
+                                                                          _spans.constEnd(),
+                                                                          column,spanEndsBefore);
+            for ( ; other != _spans.constEnd() ; ++other)
+            {
+                if (other->startColumn > span.endColumn)
+                    break;
+
+                if (other->startColumn > column)
+                {
+                    HotSpotSpan piece = span;
+                    piece.startColumn = column;
+                    piece.endColumn = other->startColumn - 1;
+                    pieces << piece;
+                }
+                if (other->endColumn >= span.endColumn)
+                {
+                    covered = true;
+                    break;
+                }
+                column = other->endColumn + 1;
+            }
+            if (!covered && column <= span.endColumn)
+            {
+                HotSpotSpan piece = span;
+                piece.startColumn = column;
+                pieces << piece;
+            }
+
+            // each piece fills a gap, which keeps the line sorted.  the
+            // hotspots of a filter are found in order, so this is usually
+            // the end of the line
+            foreach (const HotSpotSpan& piece , pieces)
+            {
+                QVector<HotSpotSpan>::iterator position = std::lower_bound(_spans.begin() + first,
+                                                                           _spans.end(),
+                                                                           piece.startColumn,
+                                                                           spanStartsBefore);
+                _spans.insert(position,piece);
+            }
+        }
+    }
+    while (nextLine <= lineCount)
+        _lineSpans[nextLine++] = _spans.count();
+}
+
+Filter::HotSpot* FilterChain::hotSpotAt(int line , int column) const
+{
+    if (line < 0 || line + 1 >= _lineSpans.count())
+        return 0;
+
+    // the last span on the line which starts at or before the column
+    QVector<HotSpotSpan>::const_iterator begin = _spans.constBegin() + _lineSpans[line];
+    QVector<HotSpotSpan>::const_iterator end = _spans.constBegin() + _lineSpans[line + 1];
+    QVector<HotSpotSpan>::const_iterator span = std::upper_bound(begin,end,column,columnBeforeSpan);
+    if (span == begin)
+        return 0;
+    --span;
+
+    return column <= span->endColumn ? span->hotSpot : 0;
+}
+
+const QVector<FilterChain::HotSpotSpan>& FilterChain::hotSpotSpans() const
+{
+    return _spans;
 }
 
 QList<Filter::HotSpot*> FilterChain::hotSpots() const
@@ -119,15 +279,53 @@ QList<Filter::HotSpot*> FilterChain::hotSpots() const
 //QList<Filter::HotSpot*> FilterChain::hotSpotsAtLine(int line) const;
 
 TerminalImageFilterChain::TerminalImageFilterChain()
-    : _buffer(0)
-    , _linePositions(0)
+    : _extendedChars(0)
+    , _pendingBlocks(false)
 {
 }
 
+void TerminalImageFilterChain::setExtendedCharTable(const ExtendedCharTable* table)
+{
+    _extendedChars = table;
+}
+
 TerminalImageFilterChain::~TerminalImageFilterChain()
 {
-    delete _buffer;
-    delete _linePositions;
+}
+
+// FNV-1a, used to identify lines and blocks by their contents
+static const quint64 KeyOffsetBasis = Q_UINT64_C(14695981039346656037);
+static const quint64 KeyPrime = Q_UINT64_C(1099511628211);
+
+static inline quint64 addToKey(quint64 key, quint64 value)
+{
+    return (key ^ value) * KeyPrime;
+}
+
+// returns a key for the text of 'count' characters, which changes when
+// the text changes but not when only the colors or attributes do
+static quint64 lineKey(const Character* characters, int count,
+                       const ExtendedCharTable* extendedChars)
+{
+    quint64 key = KeyOffsetBasis;
+    for (int i = 0; i < count; i++)
+    {
+        const Character& character = characters[i];
+        if (!(character.rendition & RE_EXTENDED_CHAR))
+        {
+            key = addToKey(key, character.character);
+            continue;
+        }
+
+        // extended characters are keyed by their sequence rather than the
+        // key in the table, which may be reused for another sequence
+        int length = 0;
+        const uint* chars = extendedChars ? extendedChars->lookupExtendedChar(character.character, length) : 0;
+        key = addToKey(key, Q_UINT64_C(1) << 32 | length);
+        for (int j = 0; j < length; j++)
+            key = addToKey(key, chars[j]);
+    }
+    return key;
 }
 
 void TerminalImageFilterChain::setImage(const Character* const image , int lines , int columns, const QVector<LineProperty>& lineProperties)
@@ -135,51 +333,141 @@ void TerminalImageFilterChain::setImage(const Character* const image , int lines
     if (empty())
         return;
 
-    // reset all filters and hotspots
-    reset();
-
     PlainTextDecoder decoder;
     decoder.setTrailingWhitespace(false);
-    
-    // setup new shared buffers for the filters to process on
-    QString* newBuffer = new QString();
-    QList<int>* newLinePositions = new QList<int>();
-    setBuffer( newBuffer , newLinePositions );
-
-    // free the old buffers
-    delete _buffer;
-    delete _linePositions;
+    decoder.setExtendedCharTable(_extendedChars);
 
-    _buffer = newBuffer;
-    _linePositions = newLinePositions;
+    // the text of lines which were already in the previous image, possibly
+    // at another position after scrolling, is taken over rather than decoded
+    QHash<quint64,int> previousLines;
+    previousLines.reserve(_lineKeys.count());
+    for (int i = 0 ; i < _lineKeys.count() ; i++)
+        previousLines.insert(_lineKeys[i],i);
 
-    QTextStream lineStream(_buffer);
-    decoder.begin(&lineStream);
+    QVector<quint64> lineKeys(lines);
+    QVector<QString> lineTexts(lines);
+    QVector<bool> lineWrapped(lines);
 
     for (int i=0 ; i < lines ; i++)
     {
-        _linePositions->append(_buffer->length());
-        decoder.decodeLine(image + i*columns,columns,LINE_DEFAULT);
+        const Character* line = image + i*columns;
+        lineKeys[i] = lineKey(line,columns,_extendedChars);
+        lineWrapped[i] = lineProperties.value(i,LINE_DEFAULT) & LINE_WRAPPED;
+
+        QHash<quint64,int>::const_iterator previous = previousLines.constFind(lineKeys[i]);
+        if (previous != previousLines.constEnd())
+        {
+            lineTexts[i] = _lineTexts[previous.value()];
+            continue;
+        }
+
+        QTextStream lineStream(&lineTexts[i]);
+        decoder.begin(&lineStream);
+        decoder.decodeLine(line,columns,LINE_DEFAULT);
+        decoder.end();
+    }
+
+    _lineKeys.swap(lineKeys);
+    _lineTexts.swap(lineTexts);
+    _lineWrapped.swap(lineWrapped);
+
+    // split the image into blocks of wrapped lines, which are keyed by the
+    // keys of their lines
+    _blocks.clear();
+    int line = 0;
+    while (line < lines)
+    {
+        Block block;
+        block.firstLine = line;
+        block.key = KeyOffsetBasis;
+        do
+        {
+            block.key = addToKey(block.key,_lineKeys[line]);
+        }
+        while (_lineWrapped[line++] && line < lines);
+        block.lineCount = line - block.firstLine;
+        block.key = addToKey(block.key,_lineWrapped[line-1]);
+        _blocks.append(block);
+    }
+}
+
+void TerminalImageFilterChain::buildBlockText(Block& block) const
+{
+    for (int i = 0 ; i < block.lineCount ; i++)
+    {
+        const int line = block.firstLine + i;
+        block.linePositions.append(block.text.length());
+        block.text += _lineTexts[line];
 
         // pretend that each line ends with a newline character.
         // this prevents a link that occurs at the end of one line
-        // being treated as part of a link that occurs at the start of the next line
-        //
-        // the downside is that links which are spread over more than one line are not
-        // highlighted.
-        //
-        // TODO - Use the "line wrapped" attribute associated with lines in a
-        // terminal image to avoid adding this imaginary character for wrapped
-        // lines
-        if ( !(lineProperties.value(i,LINE_DEFAULT) & LINE_WRAPPED) )
-            lineStream << QChar('\n');
+        // being treated as part of a link that occurs at the start of the next line.
+        // lines which are wrapped onto the next one are joined with it
+        if ( !_lineWrapped[line] )
+            block.text += QChar('\n');
     }
-    decoder.end();
+}
+
+void TerminalImageFilterChain::process()
+{
+    _matcher.update(*this);
+
+    QListIterator<Filter*> iter(*this);
+    while (iter.hasNext())
+        iter.next()->beginUpdate();
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    _pendingBlocks = false;
+
+    QList<Filter*> changed;
+    for (int i = 0 ; i < _blocks.count() ; i++)
+    {
+        Block& block = _blocks[i];
+
+        changed.clear();
+        iter.toFront();
+        while (iter.hasNext())
+        {
+            Filter* filter = iter.next();
+            if (!filter->reuseBlock(block.key,block.firstLine))
+                changed << filter;
+        }
+        if (changed.isEmpty())
+            continue;
+
+        // once the time is up, only the hotspots of unchanged blocks are
+        // carried over, the others are scanned by the next call
+        if (elapsed.elapsed() >= FILTER_TIME_BUDGET)
+        {
+            _pendingBlocks = true;
+            continue;
+        }
+
+        // the text is only put together for blocks which have changed
+        if (block.linePositions.isEmpty())
+            buildBlockText(block);
+
+        foreach (Filter* filter , changed)
+            filter->beginBlock(block.key,&block.text,&block.linePositions,block.firstLine);
+        processFilters(changed,&block.text);
+        foreach (Filter* filter , changed)
+            filter->endBlock();
+    }
+
+    iter.toFront();
+    while (iter.hasNext())
+        iter.next()->endUpdate();
+
+    buildHotSpotIndex();
 }
 
 Filter::Filter() :
     _linePositions(0),
-    _buffer(0)
+    _buffer(0),
+    _firstLine(0),
+    _blockKey(0),
+    _blockFirstSpot(0)
 {
 }
 
@@ -193,14 +481,93 @@ Filter::~Filter()
 }
 void Filter::reset()
 {
+    qDeleteAll(_hotspotList);
     _hotspots.clear();
     _hotspotList.clear();
+    _blocks.clear();
 }
 
-void Filter::setBuffer(const QString* buffer , const QList<int>* linePositions)
+void Filter::setBuffer(const QString* buffer , const QList<int>* linePositions , int firstLine)
 {
     _buffer = buffer;
     _linePositions = linePositions;
+    _firstLine = firstLine;
+    _positionColumns.clear();
+}
+
+void Filter::beginUpdate()
+{
+    // hotspots which were not found through processBlock() cannot be
+    // matched up with the new text, start over without them
+    int blockHotSpots = 0;
+    QMultiHash<quint64,Block>::const_iterator iter = _blocks.constBegin();
+    for ( ; iter != _blocks.constEnd() ; ++iter)
+        blockHotSpots += iter.value().hotSpots.count();
+    if (blockHotSpots != _hotspotList.count())
+        reset();
+
+    _previousBlocks.swap(_blocks);
+    _blocks.clear();
+    _hotspots.clear();
+    _hotspotList.clear();
+}
+
+bool Filter::reuseBlock(quint64 key , int firstLine)
+{
+    QMultiHash<quint64,Block>::iterator previous = _previousBlocks.find(key);
+    if (previous == _previousBlocks.end())
+        return false;
+
+    Block block = previous.value();
+    _previousBlocks.erase(previous);
+
+    const int delta = firstLine - block.firstLine;
+    block.firstLine = firstLine;
+    foreach (HotSpot* spot , block.hotSpots)
+    {
+        spot->moveBy(delta);
+        addHotSpot(spot);
+    }
+
+    _blocks.insert(key,block);
+    return true;
+}
+
+void Filter::processBlock(quint64 key , const QString* buffer , const QList<int>* linePositions ,
+                          int firstLine)
+{
+    beginBlock(key,buffer,linePositions,firstLine);
+    process();
+    endBlock();
+}
+
+void Filter::beginBlock(quint64 key , const QString* buffer , const QList<int>* linePositions ,
+                        int firstLine)
+{
+    setBuffer(buffer,linePositions,firstLine);
+    _blockKey = key;
+    _blockFirstSpot = _hotspotList.count();
+}
+
+void Filter::endBlock()
+{
+    Block block;
+    block.firstLine = _firstLine;
+    block.hotSpots = _hotspotList.mid(_blockFirstSpot);
+    _blocks.insert(_blockKey,block);
+}
+
+void Filter::endUpdate()
+{
+    QMultiHash<quint64,Block>::const_iterator iter = _previousBlocks.constBegin();
+    for ( ; iter != _previousBlocks.constEnd() ; ++iter)
+        qDeleteAll(iter.value().hotSpots);
+    _previousBlocks.clear();
+
+    // the buffer belongs to the caller and is gone after the update
+    _buffer = 0;
+    _linePositions = 0;
+    _positionColumns.clear();
 }
 
 void Filter::getLineColumn(int position , int& startLine , int& startColumn)
@@ -208,22 +575,53 @@ void Filter::getLineColumn(int position , int& startLine , int& startColumn)
     Q_ASSERT( _linePositions );
     Q_ASSERT( _buffer );
 
+    if ( position < 0 || position > _buffer->length() )
+        return;
 
-    for (int i = 0 ; i < _linePositions->count() ; i++)
-    {
-        int nextLine = 0;
+    // the line is the last one which starts at or before the position
+    QList<int>::const_iterator line = std::upper_bound(_linePositions->constBegin(),
+                                                       _linePositions->constEnd(),
+                                                       position);
+    if ( line == _linePositions->constBegin() )
+        return;
+    --line;
+
+    if ( _positionColumns.isEmpty() )
+        buildPositionColumns();
+
+    startLine = _firstLine + int(line - _linePositions->constBegin());
+    startColumn = _positionColumns[position] - _positionColumns[*line];
+}
+
+// fills _positionColumns with the sum of the widths of the characters in
+// the buffer in front of each position, as string_width() counts them
+void Filter::buildPositionColumns()
+{
+    const int length = _buffer->length();
+    const QChar* text = _buffer->constData();
 
-        if ( i == _linePositions->count()-1 )
-            nextLine = _buffer->length() + 1;
-        else
-            nextLine = _linePositions->value(i+1);
+    _positionColumns.resize(length + 1);
+    int* columns = _positionColumns.data();
+    columns[0] = 0;
 
-        if ( _linePositions->value(i) <= position && position < nextLine )
+    int i = 0;
+    while ( i < length )
+    {
+        uint ucs = text[i].unicode();
+
+        // characters outside of the basic multilingual plane are made up
+        // of a surrogate pair, which is counted at its first half
+        if ( QChar::isHighSurrogate(ucs) && i + 1 < length && text[i+1].isLowSurrogate() )
         {
-            startLine = i;
-            startColumn = string_width(buffer()->mid(_linePositions->value(i),position - _linePositions->value(i)));
-            return;
+            ucs = QChar::surrogateToUcs4(ucs, text[i+1].unicode());
+            columns[i+1] = columns[i] + konsole_wcwidth(ucs);
+            columns[i+2] = columns[i+1];
+            i += 2;
+            continue;
         }
+
+        columns[i+1] = columns[i] + konsole_wcwidth(ucs);
+        i++;
     }
 }
 
@@ -261,11 +659,11 @@ QList<Filter::HotSpot*> Filter::hotSpotsAtLine(int line) const
 
 Filter::HotSpot* Filter::hotSpotAt(int line , int column) const
 {
-    QListIterator<HotSpot*> spotIter(_hotspots.values(line));
+    QMultiHash<int,HotSpot*>::const_iterator spotIter = _hotspots.constFind(line);
 
-    while (spotIter.hasNext())
+    for ( ; spotIter != _hotspots.constEnd() && spotIter.key() == line ; ++spotIter)
     {
-        HotSpot* spot = spotIter.next();
+        HotSpot* spot = spotIter.value();
         
         if ( spot->startLine() == line && spot->startColumn() > column )
             continue;
@@ -320,6 +718,7 @@ void Filter::HotSpot::setType(Type type)
 }
 
 RegExpFilter::RegExpFilter()
+    : _matchesEmpty(true)     // the empty default expression matches anything
 {
 }
 
@@ -342,11 +741,14 @@ QStringList RegExpFilter::HotSpot::capturedTexts() const
     return _capturedTexts;
 }
 
-void RegExpFilter::setRegExp(const QRegExp& regExp) 
+void RegExpFilter::setRegExp(const QRegularExpression& regExp) 
 {
     _searchText = regExp;
+    _searchText.optimize();
+
+    _matchesEmpty = _searchText.match(QString("")).hasMatch();
 }
-QRegExp RegExpFilter::regExp() const
+QRegularExpression RegExpFilter::regExp() const
 {
     return _searchText;
 }
@@ -363,36 +765,39 @@ void RegExpFilter::process()
 
     // ignore any regular expressions which match an empty string.
     // otherwise the while loop below will run indefinitely
-    static const QString emptyString("");
-    if ( _searchText.exactMatch(emptyString) )
+    if ( _matchesEmpty || !_searchText.isValid() )
         return;
 
-    while(pos >= 0)
+    while (pos >= 0)
     {
-        pos = _searchText.indexIn(*text,pos);
+        const QRegularExpressionMatch match = _searchText.match(*text,pos);
+        if ( !match.hasMatch() )
+            break;
 
-        if ( pos >= 0 )
-        {
-            int startLine = 0;
-            int endLine = 0;
-            int startColumn = 0;
-            int endColumn = 0;
+        addMatch(match.capturedStart(),match.capturedLength(),match.capturedTexts());
+        pos = match.capturedEnd();
 
-            getLineColumn(pos,startLine,startColumn);
-            getLineColumn(pos + _searchText.matchedLength(),endLine,endColumn);
+        // if the match is empty, the program will get stuck in an infinite loop
+        if ( match.capturedLength() == 0 )
+            pos = -1;
+    }
+}
 
-            RegExpFilter::HotSpot* spot = newHotSpot(startLine,startColumn,
-                                                     endLine,endColumn);
-            spot->setCapturedTexts(_searchText.capturedTexts());
+void RegExpFilter::addMatch(int position , int length , const QStringList& capturedTexts)
+{
+    int startLine = 0;
+    int endLine = 0;
+    int startColumn = 0;
+    int endColumn = 0;
 
-            addHotSpot( spot );
-            pos += _searchText.matchedLength();
+    getLineColumn(position,startLine,startColumn);
+    getLineColumn(position + length,endLine,endColumn);
 
-            // if matchedLength == 0, the program will get stuck in an infinite loop
-            if ( _searchText.matchedLength() == 0 )
-                pos = -1;
-        }
-    }
+    RegExpFilter::HotSpot* spot = newHotSpot(startLine,startColumn,
+                                             endLine,endColumn);
+    spot->setCapturedTexts(capturedTexts);
+
+    addHotSpot( spot );
 }
 
 RegExpFilter::HotSpot* RegExpFilter::newHotSpot(int startLine,int startColumn,
@@ -430,13 +835,24 @@ QString UrlFilter::HotSpot::tooltip() const
     else
         return QString();
 }
+// returns an expression which only matches if 'regExp' matches the whole text
+static QRegularExpression anchored(const QRegularExpression& regExp)
+{
+    QRegularExpression result("\\A(?:" + regExp.pattern() + ")\\z", regExp.patternOptions());
+    result.optimize();
+    return result;
+}
+
 UrlFilter::HotSpot::UrlType UrlFilter::HotSpot::urlType() const
 {
+    static const QRegularExpression fullUrl = anchored(FullUrlRegExp);
+    static const QRegularExpression emailAddress = anchored(EmailAddressRegExp);
+
     QString url = capturedTexts().first();
     
-    if ( FullUrlRegExp.exactMatch(url) )
+    if ( fullUrl.match(url).hasMatch() )
         return StandardUrl;
-    else if ( EmailAddressRegExp.exactMatch(url) )
+    else if ( emailAddress.match(url).hasMatch() )
         return Email;
     else
         return Unknown;
@@ -482,14 +898,17 @@ void UrlFilter::HotSpot::activate(QString actionName)
 //regexp matches:
 // full url:  
 // protocolname:// or www. followed by anything other than whitespaces, <, >, ' or ", and ends before whitespaces, <, >, ', ", ], !, comma and dot
-const QRegExp UrlFilter::FullUrlRegExp("(www\\.(?!\\.)|[a-z][a-z0-9+.-]*://)[^\\s<>'\"]+[^!,\\.\\s<>'\"\\]]");
+const QRegularExpression UrlFilter::FullUrlRegExp("(www\\.(?!\\.)|[a-z][a-z0-9+.-]*://)[^\\s<>'\"]+[^!,\\.\\s<>'\"\\]]",
+                                                   QRegularExpression::UseUnicodePropertiesOption);
 // email address:
 // [word chars, dots or dashes]@[word chars, dots or dashes].[word chars]
-const QRegExp UrlFilter::EmailAddressRegExp("\\b(\\w|\\.|-)+@(\\w|\\.|-)+\\.\\w+\\b");
+const QRegularExpression UrlFilter::EmailAddressRegExp("\\b(\\w|\\.|-)+@(\\w|\\.|-)+\\.\\w+\\b",
+                                                       QRegularExpression::UseUnicodePropertiesOption);
 
 // matches full url or email address
-const QRegExp UrlFilter::CompleteUrlRegExp('('+FullUrlRegExp.pattern()+'|'+
-                                           EmailAddressRegExp.pattern()+')');
+const QRegularExpression UrlFilter::CompleteUrlRegExp('('+FullUrlRegExp.pattern()+'|'+
+                                                      EmailAddressRegExp.pattern()+')',
+                                                      QRegularExpression::UseUnicodePropertiesOption);
 
 UrlFilter::UrlFilter()
 {
@@ -501,6 +920,96 @@ UrlFilter::HotSpot::~HotSpot()
     delete _urlObject;
 }
 
+bool MultiRegExpMatcher::canCombine(const QRegularExpression& regExp)
+{
+    // back references would refer to the wrong groups once the expression
+    // is put into a group of its own, and named groups may clash with those
+    // of another expression
+    static const QRegularExpression groupReference("\\\\([1-9]|g|k)|\\(\\?(P?<[A-Za-z_]|'|\\|)");
+
+    return regExp.isValid() && !regExp.match(QString("")).hasMatch() &&
+           !regExp.pattern().contains(groupReference);
+}
+
+void MultiRegExpMatcher::update(const QList<Filter*>& filters)
+{
+    // the options apply to the whole of the combined expression, so only
+    // expressions with the same options as the first one are combined
+    QList<RegExpFilter*> combined;
+    QList<QRegularExpression> regExps;
+    foreach (Filter* filter , filters)
+    {
+        RegExpFilter* regExpFilter = dynamic_cast<RegExpFilter*>(filter);
+        if (regExpFilter && canCombine(regExpFilter->regExp()) &&
+            (regExps.isEmpty() || regExpFilter->regExp().patternOptions() == regExps.first().patternOptions()))
+        {
+            combined << regExpFilter;
+            regExps << regExpFilter->regExp();
+        }
+    }
+
+    if (combined == _filters && regExps == _regExps)
+        return;
+
+    _filters = combined;
+    _regExps = regExps;
+    _groups.clear();
+
+    // matching a single expression as part of an alternation gains nothing
+    if (_filters.count() < 2)
+    {
+        _regExp = QRegularExpression();
+        return;
+    }
+
+    QString pattern;
+    int group = 1;
+    for (int i = 0 ; i < _regExps.count() ; i++)
+    {
+        if (i > 0)
+            pattern += '|';
+        pattern += '(' + _regExps[i].pattern() + ')';
+
+        _groups << group;
+        group += _regExps[i].captureCount() + 1;
+    }
+    _regExp = QRegularExpression(pattern, _regExps.first().patternOptions());
+    _regExp.optimize();
+}
+
+QList<RegExpFilter*> MultiRegExpMatcher::filters() const
+{
+    return _filters.count() < 2 ? QList<RegExpFilter*>() : _filters;
+}
+
+void MultiRegExpMatcher::process(const QString& text)
+{
+    int pos = 0;
+    while (true)
+    {
+        const QRegularExpressionMatch match = _regExp.match(text,pos);
+        if (!match.hasMatch())
+            break;
+
+        // the filter whose group took part in the match
+        for (int i = 0 ; i < _filters.count() ; i++)
+        {
+            const int group = _groups[i];
+            if (match.capturedStart(group) < 0)
+                continue;
+
+            _filters[i]->addMatch(match.capturedStart(),match.capturedLength(),
+                                  match.capturedTexts().mid(group,_regExps[i].captureCount() + 1));
+            break;
+        }
+
+        // if the match is empty, the loop would not make any progress
+        if (match.capturedLength() == 0)
+            break;
+        pos = match.capturedEnd();
+    }
+}
+
 void FilterObject::emitActivated(const QUrl& url)
 {
     emit activated(url);
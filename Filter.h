@@ -29,6 +29,7 @@
 // Own includes
 typedef unsigned char LineProperty;
 class Character;
+class ExtendedCharTable;
 
 // Qt includes
 #include <QAction>
@@ -36,7 +37,8 @@ class Character;
 #include <QObject>
 #include <QStringList>
 #include <QHash>
-#include <QRegExp>
+#include <QVector>
+#include <QRegularExpression>
 
 /**
  * A filter processes blocks of text looking for certain patterns (such as URLs or keywords from a list)
@@ -132,6 +134,11 @@ public:
         void setType(Type type);
 
     private:
+        friend class Filter;
+        // moves the hotspot down by 'lines' lines, used when the text which
+        // it was found in has moved
+        void moveBy(int lines) { _startLine += lines; _endLine += lines; }
+
         int    _startLine;
         int    _startColumn;
         int    _endLine;
@@ -166,9 +173,40 @@ public:
     QList<HotSpot*> hotSpotsAtLine(int line) const;
 
     /**
-     * TODO: Document me
+     * Sets the text which process() looks at.  @p linePositions holds the position in @p buffer
+     * at which each line starts.  @p firstLine is the line of the whole text which the first
+     * line of @p buffer is, and is added to the lines of the hotspots found in it.
      */
-    void setBuffer(const QString* buffer , const QList<int>* linePositions);
+    void setBuffer(const QString* buffer , const QList<int>* linePositions , int firstLine = 0);
+
+    /**
+     * Starts an incremental update of the hotspots.
+     *
+     * Between beginUpdate() and endUpdate() the text is passed to the filter one block at a time,
+     * where a block is a line together with the lines wrapped onto it, and identified by a key
+     * derived from its contents.  reuseBlock() is called for each block first, and only if it
+     * returns false the block is processed with processBlock().  endUpdate() then deletes the
+     * hotspots of the blocks which were not passed to the filter again.
+     */
+    void beginUpdate();
+    /**
+     * Moves the hotspots found in a block with the same @p key during the previous update to
+     * @p firstLine.  Returns false if there was no such block.
+     */
+    bool reuseBlock(quint64 key , int firstLine);
+    /** Sets the text of a block with setBuffer() and processes it, see beginUpdate() */
+    void processBlock(quint64 key , const QString* buffer , const QList<int>* linePositions ,
+                      int firstLine);
+    /**
+     * Like processBlock(), but leaves finding the hotspots of the block to the caller, which
+     * adds them between beginBlock() and endBlock().  This is used to process several filters
+     * in one pass over the text.
+     */
+    void beginBlock(quint64 key , const QString* buffer , const QList<int>* linePositions ,
+                    int firstLine);
+    void endBlock();
+    /** Finishes an incremental update, see beginUpdate() */
+    void endUpdate();
 
 protected:
     /** Adds a new hotspot to the list */
@@ -179,11 +217,32 @@ protected:
     void getLineColumn(int position , int& startLine , int& startColumn);
 
 private:
+    void buildPositionColumns();
+
+    // the hotspots found in one block of text, see beginUpdate()
+    struct Block
+    {
+        int firstLine;
+        QList<HotSpot*> hotSpots;
+    };
+
     QMultiHash<int,HotSpot*> _hotspots;
     QList<HotSpot*> _hotspotList;
     
     const QList<int>* _linePositions;
     const QString* _buffer;
+    int _firstLine;
+    // the block between beginBlock() and endBlock(), and the index of its
+    // first hotspot in _hotspotList
+    quint64 _blockKey;
+    int _blockFirstSpot;
+    // the column of each position of the buffer, counted from the start of
+    // the buffer.  built by getLineColumn() when it is first needed
+    QVector<int> _positionColumns;
+
+    // blocks of the current and of the previous update, by key
+    QMultiHash<quint64,Block> _blocks;
+    QMultiHash<quint64,Block> _previousBlocks;
 };
 
 /** 
@@ -219,13 +278,14 @@ public:
 
     /**
      * Sets the regular expression which the filter searches for in blocks of text.
+     * The expression is compiled right away, with the JIT compiler where it is available.
      *
      * Regular expressions which match the empty string are treated as not matching
      * anything.
      */
-    void setRegExp(const QRegExp& text);
+    void setRegExp(const QRegularExpression& regExp);
     /** Returns the regular expression which the filter searches for in blocks of text */
-    QRegExp regExp() const;
+    QRegularExpression regExp() const;
 
     /**
      * Reimplemented to search the filter's text buffer for text matching regExp()
@@ -235,6 +295,14 @@ public:
      */
     virtual void process();
 
+    /**
+     * Adds a hotspot for a match of the regular expression, which is @p length characters long
+     * and starts at @p position in the buffer, with the texts captured by the expression.
+     * Called by process(), and by MultiRegExpMatcher when the filter is processed together
+     * with others.
+     */
+    void addMatch(int position , int length , const QStringList& capturedTexts);
+
 protected:
     /**
      * Called when a match for the regular expression is encountered.  Subclasses should reimplement this
@@ -244,7 +312,8 @@ protected:
                                               int endLine,int endColumn);
 
 private:
-    QRegExp _searchText;
+    QRegularExpression _searchText;
+    bool _matchesEmpty;     // whether _searchText matches the empty string
 };
 
 class FilterObject;
@@ -294,15 +363,53 @@ protected:
 
 private:
     
-    static const QRegExp FullUrlRegExp;
-    static const QRegExp EmailAddressRegExp;
+    static const QRegularExpression FullUrlRegExp;
+    static const QRegularExpression EmailAddressRegExp;
 
     // combined OR of FullUrlRegExp and EmailAddressRegExp
-    static const QRegExp CompleteUrlRegExp;
+    static const QRegularExpression CompleteUrlRegExp;
 signals:
     void activated(const QUrl& url);
 };
 
+/**
+ * Finds the matches of several RegExpFilters in one pass over a text.
+ *
+ * The regular expressions of the filters are combined into one alternation, with each in a
+ * capture group of its own which tells the filter a match belongs to.  Where the matches of
+ * different filters overlap, only the one which starts first is found, or the one of the filter
+ * which comes first if they start at the same position.
+ *
+ * Expressions which cannot take part in an alternation, such as ones with back references or
+ * other options than the first combined one, are left out and have to be processed on their own.
+ */
+class MultiRegExpMatcher
+{
+public:
+    /**
+     * Combines the expressions of the RegExpFilters in @p filters which can be combined.
+     * Does nothing if neither the filters nor their expressions have changed since the last call.
+     */
+    void update(const QList<Filter*>& filters);
+
+    /** Returns the filters which are combined, which is none unless there are at least two */
+    QList<RegExpFilter*> filters() const;
+
+    /**
+     * Finds the matches of the combined filters in @p text and adds them to the filters with
+     * RegExpFilter::addMatch().  The filters must have @p text set as their buffer.
+     */
+    void process(const QString& text);
+
+private:
+    static bool canCombine(const QRegularExpression& regExp);
+
+    QList<RegExpFilter*> _filters;
+    QList<QRegularExpression> _regExps;     // of the filters when _regExp was built
+    QList<int> _groups;                     // capture group of each filter in _regExp
+    QRegularExpression _regExp;
+};
+
 class FilterObject : public QObject
 {
     Q_OBJECT
@@ -338,6 +445,7 @@ signals:
 class FilterChain : protected QList<Filter*>
 {
 public:
+    FilterChain();
     virtual ~FilterChain();
 
     /** Adds a new filter to the chain.  The chain will delete this filter when it is destroyed */
@@ -354,7 +462,7 @@ public:
     /**
      * Processes each filter in the chain
      */
-    void process();
+    virtual void process();
 
     /** Sets the buffer for each filter in the chain to process. */
     void setBuffer(const QString* buffer , const QList<int>* linePositions);
@@ -366,6 +474,43 @@ public:
     /** Returns a list of all hotspots at the given line in all the chain's filters */
     QList<Filter::HotSpot> hotSpotsAtLine(int line) const;
 
+    /**
+     * The columns of a line which a hotspot covers.  Both columns are included, a hotspot
+     * which continues on the next line ends at INT_MAX.
+     */
+    struct HotSpotSpan
+    {
+        int line;
+        int startColumn;
+        int endColumn;
+        Filter::HotSpot* hotSpot;
+    };
+    /**
+     * Returns the spans of all hotspots in the chain's filters, ordered by line and column.
+     * The spans do not overlap, where hotspots do the span belongs to the one which
+     * hotSpotAt() returns.
+     */
+    const QVector<HotSpotSpan>& hotSpotSpans() const;
+
+protected:
+    /**
+     * Processes @p filters, which have @p text set as their buffer.  The regular expression
+     * filters of the chain are matched in one pass if all of them are to be processed.
+     */
+    void processFilters(const QList<Filter*>& filters , const QString* text);
+
+    MultiRegExpMatcher _matcher;
+
+    /** Rebuilds the index used by hotSpotAt() and hotSpotSpans() from the hotspots of the filters */
+    void buildHotSpotIndex();
+
+private:
+    const QString* _buffer;
+
+    QVector<HotSpotSpan> _spans;
+    // the index of the first span of each line in _spans, followed by the
+    // number of spans
+    QVector<int> _lineSpans;
 };
 
 /** A filter chain which processes character images from terminal displays */
@@ -386,7 +531,50 @@ public:
     void setImage(const Character* const image , int lines , int columns,
                   const QVector<LineProperty>& lineProperties);
 
+    /**
+     * Sets the table used to look up the sequences of characters in
+     * the image passed to setImage()
+     */
+    void setExtendedCharTable(const ExtendedCharTable* table);
+
+    /**
+     * Processes each filter in the chain.  Only the blocks of wrapped lines which have
+     * changed since the last call are scanned again, the hotspots found in the others
+     * are kept.
+     *
+     * Scanning stops once it has taken longer than a few milliseconds, so that a frame full
+     * of text which is slow to match does not hold up the GUI.  The blocks which were left
+     * out have no hotspots until process() is called again, see hasPendingBlocks().
+     */
+    virtual void process();
+
+    /**
+     * Returns true if the last call to process() ran out of time before all blocks were
+     * scanned.  process() should then be called again soon, with the same image.
+     */
+    bool hasPendingBlocks() const { return _pendingBlocks; }
+
 private:
-    QString* _buffer;
-    QList<int>* _linePositions;
+    // a line together with the lines wrapped onto it, the unit in which
+    // the text is passed to the filters
+    struct Block
+    {
+        quint64 key;
+        int firstLine;
+        int lineCount;
+        QString text;           // built when a filter has to process the block
+        QList<int> linePositions;
+    };
+
+    void buildBlockText(Block& block) const;
+
+    const ExtendedCharTable* _extendedChars;
+
+    QVector<Block> _blocks;
+    // content hash and text of each line of the image
+    QVector<quint64> _lineKeys;
+    QVector<QString> _lineTexts;
+    QVector<bool> _lineWrapped;
+
+    bool _pendingBlocks;
 };
@@ -0,0 +1,181 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own includes
+#include "GlyphAtlas.h"
+#include "konsole_wcwidth.h"
+
+// Qt includes
+#include <QtMath>
+
+// size of the atlas in pixels (before scaling by the device pixel ratio)
+#define ATLAS_SIZE 1024
+
+GlyphAtlas::GlyphAtlas()
+    : _cellWidth(1)
+    , _cellHeight(1)
+    , _baseline(0)
+    , _devicePixelRatio(1.0)
+    , _nextX(0)
+    , _nextY(0)
+    , _generation(0)
+{
+}
+
+void GlyphAtlas::setFont(const QFont& font, int cellWidth, int cellHeight, int baseline)
+{
+    _font = font;
+    _cellWidth = qMax(1,cellWidth);
+    _cellHeight = qMax(1,cellHeight);
+    _baseline = baseline;
+
+    clear();
+}
+
+void GlyphAtlas::clear()
+{
+    _glyphs.clear();
+    _nextX = 0;
+    _nextY = 0;
+    _generation++;
+}
+
+// returns the code point starting at 'index' in 'text' and advances 'index'
+// past it.  unpaired surrogates are returned as they are
+static inline uint nextCodePoint(const QString& text, int& index)
+{
+    const ushort c = text.at(index++).unicode();
+    if (QChar::isHighSurrogate(c) && index < text.length() && text.at(index).isLowSurrogate())
+        return QChar::surrogateToUcs4(c, text.at(index++).unicode());
+    return c;
+}
+
+QRect GlyphAtlas::glyph(uint character, int width, QRgb color, bool bold, bool underline)
+{
+    const quint64 key = (quint64(color) << 32) | (character << 2) |
+                        (bold ? 2 : 0) | (underline ? 1 : 0);
+
+    QHash<quint64,QRect>::const_iterator iter = _glyphs.constFind(key);
+    if (iter != _glyphs.constEnd())
+        return iter.value();
+
+    if (_atlas.isNull())
+    {
+        const int size = qCeil(ATLAS_SIZE * _devicePixelRatio);
+        _atlas = QPixmap(size, size);
+        _atlas.setDevicePixelRatio(_devicePixelRatio);
+        // filling with a transparent color gives the pixmap an alpha channel
+        _atlas.fill(Qt::transparent);
+    }
+
+    // find space for the glyph, starting over once the atlas is full
+    const int glyphWidth = _cellWidth * width;
+    if (_nextX + glyphWidth > ATLAS_SIZE)
+    {
+        _nextX = 0;
+        _nextY += _cellHeight;
+    }
+    if (_nextY + _cellHeight > ATLAS_SIZE)
+        clear();
+
+    const QRect rect(_nextX, _nextY, glyphWidth, _cellHeight);
+    _nextX += glyphWidth;
+
+    QFont font = _font;
+    font.setBold(bold);
+    font.setUnderline(underline);
+
+    QPainter painter(&_atlas);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.fillRect(rect, Qt::transparent);
+    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    painter.setClipRect(rect);
+    painter.setFont(font);
+    painter.setPen(QColor::fromRgba(color));
+    painter.drawText(rect.left(), rect.top() + _baseline, QString::fromUcs4(&character, 1));
+
+    _glyphs.insert(key, rect);
+    return rect;
+}
+
+bool GlyphAtlas::drawText(QPainter& painter, const QPoint& position, const QString& text,
+                          const QColor& color, bool bold, bool underline)
+{
+    if (text.isEmpty())
+        return true;
+    if (_cellWidth * 2 > ATLAS_SIZE || _cellHeight > ATLAS_SIZE)
+        return false;
+
+    const qreal devicePixelRatio = painter.device()->devicePixelRatioF();
+    if (_devicePixelRatio != devicePixelRatio)
+    {
+        _devicePixelRatio = devicePixelRatio;
+        _atlas = QPixmap();
+        clear();
+    }
+
+    // check that every character occupies whole cells before drawing any
+    for (int i = 0; i < text.length(); )
+    {
+        const uint c = nextCodePoint(text, i);
+        if (QChar::isSurrogate(c))
+            return false;
+
+        const int width = konsole_wcwidth(c);
+        if (width != 1 && width != 2)
+            return false;
+    }
+
+    // all fragments must refer to glyphs from the same generation of the
+    // atlas, so if it had to be cleared while collecting them start again.
+    // text which does not fit into an empty atlas is left to the caller
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        const int generation = _generation;
+        _fragments.resize(0);
+
+        int x = position.x();
+        for (int i = 0; i < text.length(); )
+        {
+            const uint c = nextCodePoint(text, i);
+            const int width = konsole_wcwidth(c);
+
+            // blank cells only need their background, which is already drawn
+            if (c != ' ' || underline)
+            {
+                const QRect source = glyph(c, width, color.rgba(), bold, underline);
+
+                // fragments take the source in device pixels of the atlas
+                _fragments.append(QPainter::PixmapFragment::create(
+                                      QPointF(x + source.width() / 2.0,
+                                              position.y() + source.height() / 2.0),
+                                      QRectF(source.topLeft() * _devicePixelRatio,
+                                             source.size() * _devicePixelRatio),
+                                      1.0 / _devicePixelRatio, 1.0 / _devicePixelRatio));
+            }
+            x += _cellWidth * width;
+        }
+
+        if (generation == _generation)
+        {
+            painter.drawPixmapFragments(_fragments.constData(), _fragments.count(), _atlas);
+            return true;
+        }
+    }
+
+    return false;
+}
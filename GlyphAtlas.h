@@ -0,0 +1,92 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#pragma once
+
+// Qt includes
+#include <QFont>
+#include <QHash>
+#include <QPainter>
+#include <QPixmap>
+#include <QVector>
+
+/**
+ * Draws terminal text from pre-rendered glyphs.
+ *
+ * Each glyph is rasterised once, for a given character, color, weight
+ * and underline, into a cell of a shared pixmap (the atlas).  Text is then
+ * drawn by copying cells out of the atlas with a single
+ * QPainter::drawPixmapFragments() call per text fragment, which avoids
+ * laying out and rasterising the same few characters over and over.
+ *
+ * Only text on a fixed grid can be drawn this way.  drawText() refuses
+ * text containing characters which do not occupy exactly one or two cells,
+ * such as combining characters, and the caller is expected to fall back
+ * to QPainter::drawText() for it.
+ *
+ * When the atlas is full, all glyphs are discarded and it is filled again
+ * with the glyphs which are used from then on.
+ */
+class GlyphAtlas
+{
+public:
+    GlyphAtlas();
+
+    /**
+     * Sets the font and the geometry of the character cells.  This
+     * discards all glyphs rendered so far.
+     *
+     * @param font The font used to draw characters
+     * @param cellWidth The width of a single-width character cell in pixels
+     * @param cellHeight The height of a character cell in pixels
+     * @param baseline The distance from the top of a cell to the baseline of the text
+     */
+    void setFont(const QFont& font, int cellWidth, int cellHeight, int baseline);
+
+    /** Discards all glyphs rendered so far */
+    void clear();
+
+    /**
+     * Draws @p text starting with the cell whose top left corner is at
+     * @p position.  Returns false without drawing anything if @p text contains
+     * characters which cannot be drawn from the atlas.
+     *
+     * The glyphs are rendered for the device pixel ratio of the painter's
+     * device, if that changes the atlas is cleared.
+     */
+    bool drawText(QPainter& painter, const QPoint& position, const QString& text,
+                  const QColor& color, bool bold, bool underline);
+
+private:
+    // returns the area of the atlas holding the glyph for 'character',
+    // rendering it first if necessary
+    QRect glyph(uint character, int width, QRgb color, bool bold, bool underline);
+
+    QFont _font;
+    int _cellWidth;
+    int _cellHeight;
+    int _baseline;
+    qreal _devicePixelRatio;
+
+    QPixmap _atlas;
+    QHash<quint64,QRect> _glyphs;
+    int _nextX;     // position of the next free cell in the atlas
+    int _nextY;
+    int _generation; // incremented each time the atlas is cleared
+
+    QVector<QPainter::PixmapFragment> _fragments;
+};
@@ -100,6 +100,182 @@ bool HistoryScroll::hasScroll()
     return true;
 }
 
+// History File ///////////////////////////////////////////
+
+HistoryFile::HistoryFile(const QString& fileTemplate)
+    : length(0),
+      fileMap(0),
+      mappedLength(0),
+      mapFailed(false)
+{
+    if (!fileTemplate.isEmpty())
+        tmpFile.setFileTemplate(fileTemplate);
+
+    if (!tmpFile.open())
+        qWarning() << "HistoryFile: unable to create temporary file" << tmpFile.errorString();
+}
+
+HistoryFile::~HistoryFile()
+{
+    unmap();
+}
+
+void HistoryFile::map()
+{
+    Q_ASSERT( fileMap == 0 || mappedLength < length );
+
+    unmap();
+
+    // pending writes must reach the file before it is mapped
+    if (!tmpFile.flush())
+        return;
+
+    fileMap = tmpFile.map(0, length);
+    if (fileMap)
+    {
+        mappedLength = length;
+    }
+    else
+    {
+        qWarning() << "HistoryFile: mapping failed, reading from file instead" << tmpFile.errorString();
+        mapFailed = true;
+    }
+}
+
+void HistoryFile::unmap()
+{
+    if (fileMap)
+    {
+        tmpFile.unmap(fileMap);
+        fileMap = 0;
+        mappedLength = 0;
+    }
+}
+
+void HistoryFile::add(const unsigned char* bytes, qint64 len)
+{
+    if (!tmpFile.isOpen())
+        return;
+
+    qint64 rc = tmpFile.write(reinterpret_cast<const char*>(bytes), len);
+    if (rc != len)
+    {
+        qWarning() << "HistoryFile::add:" << tmpFile.errorString();
+        // keep 'length' in sync with what actually is in the file
+        if (rc > 0)
+            length += rc;
+        return;
+    }
+    length += len;
+}
+
+void HistoryFile::get(unsigned char* bytes, qint64 len, qint64 loc)
+{
+    if (loc < 0 || len < 0 || loc + len > length)
+    {
+        qWarning() << "HistoryFile::get: invalid range" << loc << len << length;
+        return;
+    }
+
+    if (len == 0)
+        return;
+
+    // the mapping is only renewed once the file has doubled in size, so
+    // that reading the lines added since costs a seek and read rather than
+    // mapping the whole file again each time
+    if (loc + len > mappedLength && !mapFailed && length >= 2 * mappedLength)
+        map();
+
+    if (loc + len <= mappedLength)
+    {
+        memcpy(bytes, fileMap + loc, len);
+        return;
+    }
+
+    // the range is not mapped (yet), or the file could not be mapped
+    if (!tmpFile.seek(loc) || tmpFile.read(reinterpret_cast<char*>(bytes), len) != len)
+        qWarning() << "HistoryFile::get:" << tmpFile.errorString();
+
+    // further writes must go to the end of the file
+    tmpFile.seek(length);
+}
+
+// History Scroll File //////////////////////////////////////
+
+/*
+   The history scroll makes a Row(Row(Cell)) from
+   two history buffers. The index buffer contains
+   end of line positions which refer to the cells
+   buffer.
+
+   Note that index[0] addresses the second line
+   (line #1), while the first line (line #0) starts
+   at 0 in cells.
+*/
+
+HistoryScrollFile::HistoryScrollFile(const QString &logFileName)
+    : HistoryScroll(new HistoryTypeFile(logFileName)),
+      m_logFileName(logFileName),
+      index(logFileName.isEmpty() ? QString() : logFileName + ".index.XXXXXX"),
+      cells(logFileName.isEmpty() ? QString() : logFileName + ".cells.XXXXXX"),
+      lineflags(logFileName.isEmpty() ? QString() : logFileName + ".flags.XXXXXX")
+{
+}
+
+HistoryScrollFile::~HistoryScrollFile()
+{
+}
+
+int HistoryScrollFile::getLines()
+{
+    return index.len() / sizeof(qint64);
+}
+
+int HistoryScrollFile::getLineLen(int lineno)
+{
+    return (startOfLine(lineno+1) - startOfLine(lineno)) / sizeof(Character);
+}
+
+bool HistoryScrollFile::isWrappedLine(int lineno)
+{
+    if (lineno>=0 && lineno < getLines()) {
+        unsigned char flag = 0;
+        lineflags.get(&flag,sizeof(unsigned char),lineno*sizeof(unsigned char));
+        return flag;
+    }
+    return false;
+}
+
+qint64 HistoryScrollFile::startOfLine(int lineno)
+{
+    if (lineno <= 0) return 0;
+    if (lineno <= getLines())
+    {
+        qint64 res = 0;
+        index.get((unsigned char*)&res,sizeof(qint64),(qint64)(lineno-1)*sizeof(qint64));
+        return res;
+    }
+    return cells.len();
+}
+
+void HistoryScrollFile::getCells(int lineno, int colno, int count, Character res[])
+{
+    cells.get((unsigned char*)res,(qint64)count*sizeof(Character),startOfLine(lineno)+(qint64)colno*sizeof(Character));
+}
+
+void HistoryScrollFile::addCells(const Character text[], int count)
+{
+    cells.add((const unsigned char*)text,(qint64)count*sizeof(Character));
+}
+
+void HistoryScrollFile::addLine(bool previousWrapped)
+{
+    qint64 locn = cells.len();
+    index.add((unsigned char*)&locn,sizeof(qint64));
+    unsigned char flags = previousWrapped ? 0x01 : 0x00;
+    lineflags.add(&flags,sizeof(unsigned char));
+}
+
 // History Scroll Buffer //////////////////////////////////////
 HistoryScrollBuffer::HistoryScrollBuffer(unsigned int maxLineCount)
     : HistoryScroll(new HistoryTypeBuffer(maxLineCount))
@@ -116,7 +292,7 @@ HistoryScrollBuffer::~HistoryScrollBuffer()
     delete[] _historyBuffer;
 }
 
-void HistoryScrollBuffer::addCellsVector(const QVector<Character>& cells)
+void HistoryScrollBuffer::addCells(const Character a[], int count)
 {
     _head++;
     if ( _usedLines < _maxLineCount )
@@ -127,15 +303,15 @@ void HistoryScrollBuffer::addCellsVector(const QVector<Character>& cells)
         _head = 0;
     }
 
-    _historyBuffer[bufferIndex(_usedLines-1)] = cells;
-    _wrappedLine[bufferIndex(_usedLines-1)] = false;
-}
-void HistoryScrollBuffer::addCells(const Character a[], int count)
-{
-    HistoryLine newLine(count);
-    std::copy(a,a+count,newLine.begin());
+    // copy into the storage of the line being overwritten rather than
+    // sharing or allocating a new one, so that once the buffer is full
+    // adding a line does not allocate
+    HistoryLine& line = _historyBuffer[bufferIndex(_usedLines-1)];
+    line.resize(count);
+    if (count > 0)
+        memcpy(line.data(), a, count * sizeof(Character));
 
-    addCellsVector(newLine);
+    _wrappedLine[bufferIndex(_usedLines-1)] = false;
 }
 
 void HistoryScrollBuffer::addLine(bool previousWrapped)
@@ -279,10 +455,341 @@ void HistoryScrollNone::addLine(bool)
 {
 }
 
+// Compact History Scroll //////////////////////////////////////
+
+// all allocations from a block are rounded up to this size, so that the
+// line objects and their format arrays are suitably aligned
+#define BLOCK_ALIGNMENT 8
+
+CompactHistoryBlock::CompactHistoryBlock(size_t length)
+    : blockLength(length)
+    , allocCount(0)
+{
+    blockStart = (quint8*) malloc(blockLength);
+    Q_CHECK_PTR(blockStart);
+    tail = blockStart;
+}
+
+CompactHistoryBlock::~CompactHistoryBlock()
+{
+    free(blockStart);
+}
+
+void* CompactHistoryBlock::allocate(size_t length)
+{
+    Q_ASSERT( length > 0 );
+
+    length = (length + BLOCK_ALIGNMENT - 1) & ~(size_t)(BLOCK_ALIGNMENT - 1);
+    if ( length > remaining() )
+        return 0;
+
+    void* block = tail;
+    tail += length;
+    allocCount++;
+    return block;
+}
+
+void CompactHistoryBlock::deallocate()
+{
+    allocCount--;
+    Q_ASSERT( allocCount >= 0 );
+}
+
+void CompactHistoryBlock::reset()
+{
+    Q_ASSERT( !isInUse() );
+    tail = blockStart;
+}
+
+CompactHistoryBlockList::CompactHistoryBlockList()
+    : spare(0)
+{
+}
+
+CompactHistoryBlockList::~CompactHistoryBlockList()
+{
+    qDeleteAll(list);
+    list.clear();
+    delete spare;
+}
+
+void* CompactHistoryBlockList::allocate(size_t size)
+{
+    if ( !list.isEmpty() )
+    {
+        void* ptr = list.last()->allocate(size);
+        if ( ptr )
+            return ptr;
+    }
+
+    CompactHistoryBlock* block;
+    if ( spare && spare->length() >= size + BLOCK_ALIGNMENT )
+    {
+        block = spare;
+        spare = 0;
+    }
+    else
+    {
+        // oversized requests (very long lines with many format changes)
+        // get a block of their own
+        block = new CompactHistoryBlock(qMax(size + BLOCK_ALIGNMENT,
+                                             (size_t)CompactHistoryBlock::DefaultBlockLength));
+    }
+    list.append(block);
+
+    return block->allocate(size);
+}
+
+void CompactHistoryBlockList::deallocate(void* ptr)
+{
+    Q_ASSERT( !list.isEmpty() );
+
+    // lines are dropped oldest first, so the block is almost always
+    // found at the front of the list
+    int i = 0;
+    while ( i < list.size() && !list.at(i)->contains(ptr) )
+        i++;
+
+    Q_ASSERT( i < list.size() );
+    if ( i == list.size() )
+        return;
+
+    CompactHistoryBlock* block = list.at(i);
+    block->deallocate();
+
+    if ( !block->isInUse() )
+    {
+        list.removeAt(i);
+
+        if ( block->length() == CompactHistoryBlock::DefaultBlockLength )
+        {
+            block->reset();
+            delete spare;
+            spare = block;
+        }
+        else
+        {
+            delete block;
+        }
+    }
+}
+
+void* CompactHistoryLine::operator new(size_t size, CompactHistoryBlockList& blockList)
+{
+    return blockList.allocate(size);
+}
+
+void CompactHistoryLine::operator delete(void* ptr, CompactHistoryBlockList& blockList)
+{
+    blockList.deallocate(ptr);
+}
+
+CompactHistoryLine::CompactHistoryLine(const Character line[], int count, CompactHistoryBlockList& bList)
+    : blockList(bList)
+    , formatArray(0)
+    , text(0)
+    , length(count)
+    , formatLength(0)
+    , wrapped(false)
+{
+    Q_ASSERT( count >= 0 && count <= 0xffff );
+
+    if ( length == 0 )
+        return;
+
+    // count number of different formats in this text line
+    formatLength = 1;
+    for ( int k = 1 ; k < length ; k++ )
+    {
+        if ( !line[k].equalsFormat(line[k-1]) )
+            formatLength++;
+    }
+
+    formatArray = (CharacterFormat*) blockList.allocate(sizeof(CharacterFormat)*formatLength);
+    text = (quint32*) blockList.allocate(sizeof(quint32)*length);
+
+    // record formats and their positions in the format array,
+    // there is always at least one format covering the start of the line
+    formatArray[0].setFormat(line[0]);
+    formatArray[0].startPos = 0;
+
+    int j = 1;
+    for ( int k = 1 ; k < length ; k++ )
+    {
+        if ( !line[k].equalsFormat(line[k-1]) )
+        {
+            formatArray[j].setFormat(line[k]);
+            formatArray[j].startPos = k;
+            j++;
+        }
+    }
+    Q_ASSERT( j == formatLength );
+
+    // copy character values
+    for ( int i = 0 ; i < length ; i++ )
+        text[i] = line[i].character;
+}
+
+CompactHistoryLine::~CompactHistoryLine()
+{
+    if ( length > 0 )
+    {
+        blockList.deallocate(text);
+        blockList.deallocate(formatArray);
+    }
+    blockList.deallocate(this);
+}
+
+void CompactHistoryLine::getCharacters(Character* array, int count, int startColumn) const
+{
+    Q_ASSERT( startColumn >= 0 && count >= 0 );
+    Q_ASSERT( startColumn + count <= length );
+
+    if ( count == 0 )
+        return;
+
+    // find the format in effect at startColumn, then walk the
+    // format runs alongside the characters
+    int formatPos = 0;
+    while ( formatPos+1 < formatLength && startColumn >= formatArray[formatPos+1].startPos )
+        formatPos++;
+
+    const int endColumn = startColumn + count;
+    for ( int i = startColumn ; i < endColumn ; i++ )
+    {
+        if ( formatPos+1 < formatLength && i >= formatArray[formatPos+1].startPos )
+            formatPos++;
+
+        const CharacterFormat& format = formatArray[formatPos];
+        Character& c = array[i-startColumn];
+        c.character = text[i];
+        c.rendition = format.rendition;
+        c.foregroundColor = format.fgColor;
+        c.backgroundColor = format.bgColor;
+    }
+}
+
+CompactHistoryScroll::CompactHistoryScroll(unsigned int maxLineCount)
+    : HistoryScroll(new CompactHistoryType(maxLineCount))
+    , _maxLineCount(0)
+{
+    setMaxNbLines(maxLineCount);
+}
+
+CompactHistoryScroll::~CompactHistoryScroll()
+{
+    // the lines must go before the block list which holds their memory
+    qDeleteAll(lines);
+    lines.clear();
+}
+
+void CompactHistoryScroll::addCellsVector(const TextLine& cells)
+{
+    addCells(cells.constData(), cells.size());
+}
+
+void CompactHistoryScroll::addCells(const Character a[], int count)
+{
+    // drop the oldest line first, so that its memory can be reused
+    if ( _maxLineCount > 0 && lines.size() >= (int) _maxLineCount )
+        delete lines.takeFirst();
+
+    lines.append(new (blockList) CompactHistoryLine(a, count, blockList));
+}
+
+void CompactHistoryScroll::addLine(bool previousWrapped)
+{
+    if ( lines.isEmpty() )
+        return;
+
+    lines.last()->setWrapped(previousWrapped);
+}
+
+int CompactHistoryScroll::getLines()
+{
+    return lines.size();
+}
+
+int CompactHistoryScroll::getLineLen(int lineNumber)
+{
+    Q_ASSERT( lineNumber >= 0 );
+
+    if ( lineNumber < lines.size() )
+        return lines.at(lineNumber)->getLength();
+    else
+        return 0;
+}
+
+bool CompactHistoryScroll::isWrappedLine(int lineNumber)
+{
+    Q_ASSERT( lineNumber >= 0 );
+
+    if ( lineNumber < lines.size() )
+        return lines.at(lineNumber)->isWrapped();
+    else
+        return false;
+}
+
+void CompactHistoryScroll::getCells(int lineNumber, int startColumn, int count, Character buffer[])
+{
+    if ( count == 0 ) return;
+
+    if ( lineNumber >= lines.size() )
+    {
+        memset(buffer, 0, count * sizeof(Character));
+        return;
+    }
+
+    lines.at(lineNumber)->getCharacters(buffer, count, startColumn);
+}
+
+void CompactHistoryScroll::setMaxNbLines(unsigned int lineCount)
+{
+    _maxLineCount = lineCount;
+
+    if ( _maxLineCount > 0 )
+    {
+        while ( lines.size() > (int) _maxLineCount )
+            delete lines.takeFirst();
+    }
+
+    dynamic_cast<CompactHistoryType*>(m_histType)->m_nbLines = lineCount;
+}
+
 //////////////////////////////////////////////////////////////////////
 // History Types
 //////////////////////////////////////////////////////////////////////
 
+// copies the last 'maxLines' lines (or all lines if 'maxLines' is 0)
+// of the 'from' history into 'to'
+static void copyHistory(HistoryScroll* from, HistoryScroll* to, int maxLines)
+{
+    int lines = from->getLines();
+    int startLine = 0;
+    if (maxLines > 0 && lines > maxLines)
+        startLine = lines - maxLines;
+
+    Character line[LINE_SIZE];
+    for(int i = startLine; i < lines; i++)
+    {
+        int size = from->getLineLen(i);
+        if (size > LINE_SIZE)
+        {
+            Character *tmp_line = new Character[size];
+            from->getCells(i, 0, size, tmp_line);
+            to->addCells(tmp_line, size);
+            to->addLine(from->isWrappedLine(i));
+            delete [] tmp_line;
+        }
+        else
+        {
+            from->getCells(i, 0, size, line);
+            to->addCells(line, size);
+            to->addLine(from->isWrappedLine(i));
+        }
+    }
+}
+
 HistoryType::HistoryType()
 {
 }
@@ -315,6 +822,42 @@ int HistoryTypeNone::maximumLineCount() const
 
 //////////////////////////////
 
+HistoryTypeFile::HistoryTypeFile(QString fileName)
+    : m_fileName(fileName)
+{
+}
+
+bool HistoryTypeFile::isEnabled() const
+{
+    return true;
+}
+
+QString HistoryTypeFile::getFileName() const
+{
+    return m_fileName;
+}
+
+int HistoryTypeFile::maximumLineCount() const
+{
+    return 0;
+}
+
+HistoryScroll* HistoryTypeFile::scroll(HistoryScroll *old) const
+{
+    if (dynamic_cast<HistoryScrollFile *>(old))
+        return old; // Unchanged.
+
+    HistoryScroll *newScroll = new HistoryScrollFile(m_fileName);
+    if (old)
+    {
+        copyHistory(old, newScroll, 0);
+        delete old;
+    }
+    return newScroll;
+}
+
+//////////////////////////////
+
 HistoryTypeBuffer::HistoryTypeBuffer(unsigned int nbLines)
     : m_nbLines(nbLines)
 {
@@ -342,32 +885,45 @@ HistoryScroll* HistoryTypeBuffer::scroll(HistoryScroll *old) const
         }
 
         HistoryScroll *newScroll = new HistoryScrollBuffer(m_nbLines);
-        int lines = old->getLines();
-        int startLine = 0;
-        if (lines > (int) m_nbLines)
-            startLine = lines - m_nbLines;
+        copyHistory(old, newScroll, m_nbLines);
+        delete old;
+        return newScroll;
+    }
+    return new HistoryScrollBuffer(m_nbLines);
+}
+
+//////////////////////////////
+
+CompactHistoryType::CompactHistoryType(unsigned int nbLines)
+    : m_nbLines(nbLines)
+{
+}
+
+bool CompactHistoryType::isEnabled() const
+{
+    return true;
+}
+
+int CompactHistoryType::maximumLineCount() const
+{
+    return m_nbLines;
+}
 
-        Character line[LINE_SIZE];
-        for(int i = startLine; i < lines; i++)
+HistoryScroll* CompactHistoryType::scroll(HistoryScroll *old) const
+{
+    if (old)
+    {
+        CompactHistoryScroll *oldBuffer = dynamic_cast<CompactHistoryScroll*>(old);
+        if (oldBuffer)
         {
-            int size = old->getLineLen(i);
-            if (size > LINE_SIZE)
-            {
-                Character *tmp_line = new Character[size];
-                old->getCells(i, 0, size, tmp_line);
-                newScroll->addCells(tmp_line, size);
-                newScroll->addLine(old->isWrappedLine(i));
-                delete [] tmp_line;
-            }
-            else
-            {
-                old->getCells(i, 0, size, line);
-                newScroll->addCells(line, size);
-                newScroll->addLine(old->isWrappedLine(i));
-            }
+            oldBuffer->setMaxNbLines(m_nbLines);
+            return oldBuffer;
         }
+
+        HistoryScroll *newScroll = new CompactHistoryScroll(m_nbLines);
+        copyHistory(old, newScroll, m_nbLines);
         delete old;
         return newScroll;
     }
-    return new HistoryScrollBuffer(m_nbLines);
+    return new CompactHistoryScroll(m_nbLines);
 }
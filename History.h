@@ -33,6 +33,7 @@
 // Qt
 #include <QBitRef>
 #include <QHash>
+#include <QList>
 #include <QVector>
 #include <QTemporaryFile>
 
@@ -81,6 +82,75 @@ protected:
 
 };
 
+//////////////////////////////////////////////////////////////////////
+// File-based history (e.g. file log, no limitation in length)
+//////////////////////////////////////////////////////////////////////
+
+/**
+ * An append-only temporary file.  Data is written with add() and read back
+ * with get(), which serves reads from a memory mapping of the file so that
+ * scrolled-past output does not have to stay resident.  The tail written since
+ * the file was last mapped is read with seek and read.
+ */
+class HistoryFile
+{
+public:
+    /**
+     * Creates and opens a new temporary file.  @p fileTemplate is passed
+     * to QTemporaryFile; if it is empty the default template is used.
+     */
+    HistoryFile(const QString& fileTemplate = QString());
+    ~HistoryFile();
+
+    /** Appends @p len bytes from @p bytes to the end of the file. */
+    void add(const unsigned char* bytes, qint64 len);
+    /** Reads @p len bytes starting at offset @p loc into @p bytes. */
+    void get(unsigned char* bytes, qint64 len, qint64 loc);
+    /** Returns the number of bytes written to the file. */
+    qint64 len() const { return length; }
+
+private:
+    // maps the whole file, replacing any previous (shorter) mapping
+    void map();
+    void unmap();
+
+    QTemporaryFile tmpFile;
+    qint64 length;
+
+    // start of the mapped file data, or 0 if the file is not mapped.  the
+    // file is opened for reading and writing, so is the mapping, but it is
+    // only ever read from
+    uchar* fileMap;
+    // number of bytes covered by fileMap.  reads beyond this go to the file,
+    // until the file has grown to twice this size and is mapped again
+    qint64 mappedLength;
+    // set when mapping failed, all reads then go to the file
+    bool mapFailed;
+};
+
+class HistoryScrollFile : public HistoryScroll
+{
+public:
+    HistoryScrollFile(const QString &logFileName);
+    virtual ~HistoryScrollFile();
+
+    virtual int  getLines();
+    virtual int  getLineLen(int lineno);
+    virtual void getCells(int lineno, int colno, int count, Character res[]);
+    virtual bool isWrappedLine(int lineno);
+
+    virtual void addCells(const Character a[], int count);
+    virtual void addLine(bool previousWrapped=false);
+
+private:
+    qint64 startOfLine(int lineno);
+
+    QString m_logFileName;
+    HistoryFile index;     // end offset of each line in 'cells' (qint64)
+    HistoryFile cells;     // text of all lines (Character)
+    HistoryFile lineflags; // flags of each line (unsigned char)
+};
+
 //////////////////////////////////////////////////////////////////////
 // Buffer-based history (limited to a fixed nb of lines)
 //////////////////////////////////////////////////////////////////////
@@ -98,7 +168,6 @@ public:
     virtual bool isWrappedLine(int lineno);
 
     virtual void addCells(const Character a[], int count);
-    virtual void addCellsVector(const QVector<Character>& cells);
     virtual void addLine(bool previousWrapped=false);
 
     void setMaxNbLines(unsigned int nbLines);
@@ -164,6 +233,118 @@ public:
     quint8 rendition;
 };
 
+/**
+ * A fixed-size chunk of memory from which history lines are allocated
+ * sequentially.  Individual allocations are never returned to the block;
+ * instead the block counts its live allocations and is released as a whole
+ * once all of them have been deallocated.
+ */
+class CompactHistoryBlock
+{
+public:
+    /** The size of a regular block, lines are packed into blocks of this size. */
+    static const size_t DefaultBlockLength = 256*1024;
+
+    CompactHistoryBlock(size_t length = DefaultBlockLength);
+    ~CompactHistoryBlock();
+
+    size_t remaining() const { return blockStart+blockLength-tail; }
+    size_t length() const { return blockLength; }
+    void* allocate(size_t length);
+    bool contains(void* addr) const { return addr>=blockStart && addr<(blockStart+blockLength); }
+    void deallocate();
+    bool isInUse() const { return allocCount!=0; }
+    /** Makes the whole block available again.  Only valid when !isInUse() */
+    void reset();
+
+private:
+    size_t blockLength;
+    quint8* tail;
+    quint8* blockStart;
+    int allocCount;
+};
+
+/**
+ * The arena used by CompactHistoryScroll.  Allocations are served from the
+ * newest block; blocks are freed when the last line living in them is
+ * dropped from the history.  One empty block is kept around so that a full
+ * history which keeps rotating lines does not repeatedly allocate blocks.
+ */
+class CompactHistoryBlockList
+{
+public:
+    CompactHistoryBlockList();
+    ~CompactHistoryBlockList();
+
+    void* allocate(size_t size);
+    void deallocate(void* ptr);
+    int length() const { return list.size(); }
+
+private:
+    QList<CompactHistoryBlock*> list;
+    CompactHistoryBlock* spare;
+};
+
+/**
+ * A single line of history.  The line object, its character values and its
+ * formats are all allocated from a CompactHistoryBlockList.  Only the
+ * unicode value of each character is stored per cell, the colors and
+ * rendition are stored once per run of equally formatted characters.
+ */
+class CompactHistoryLine
+{
+public:
+    CompactHistoryLine(const Character line[], int count, CompactHistoryBlockList& blockList);
+    ~CompactHistoryLine();
+
+    // custom new operator to allocate memory from custom pool instead of heap
+    static void* operator new(size_t size, CompactHistoryBlockList& blockList);
+    // matching placement delete, only called if the constructor throws
+    static void operator delete(void* ptr, CompactHistoryBlockList& blockList);
+    // do nothing, deallocation from pool is done in the destructor
+    static void operator delete(void*) {}
+
+    void getCharacters(Character* array, int length, int startColumn) const;
+    bool isWrapped() const { return wrapped; }
+    void setWrapped(bool isWrapped) { wrapped=isWrapped; }
+    int getLength() const { return length; }
+
+private:
+    CompactHistoryBlockList& blockList;
+    CharacterFormat* formatArray;
+    quint32* text;
+    quint16 length;
+    quint16 formatLength;
+    bool wrapped;
+};
+
+class CompactHistoryScroll : public HistoryScroll
+{
+    typedef QList<CompactHistoryLine*> HistoryArray;
+
+public:
+    CompactHistoryScroll(unsigned int maxNbLines = 1000);
+    virtual ~CompactHistoryScroll();
+
+    virtual int  getLines();
+    virtual int  getLineLen(int lineno);
+    virtual void getCells(int lineno, int colno, int count, Character res[]);
+    virtual bool isWrappedLine(int lineno);
+
+    virtual void addCells(const Character a[], int count);
+    virtual void addCellsVector(const TextLine& cells);
+    virtual void addLine(bool previousWrapped=false);
+
+    void setMaxNbLines(unsigned int nbLines);
+    unsigned int maxNbLines() const { return _maxLineCount; }
+
+private:
+    HistoryArray lines;
+    CompactHistoryBlockList blockList;
+
+    unsigned int _maxLineCount;
+};
+
 //////////////////////////////////////////////////////////////////////
 // History type
 //////////////////////////////////////////////////////////////////////
@@ -236,6 +417,8 @@ protected:
 
 class CompactHistoryType : public HistoryType
 {
+    friend class CompactHistoryScroll;
+
 public:
     CompactHistoryType(unsigned int size);
 
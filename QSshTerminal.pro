@@ -23,6 +23,10 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+# Store the screen image as one contiguous grid of cells instead of a
+# separately allocated vector per line.  Comment out to use vector lines.
+DEFINES += SCREEN_CELL_GRID
+
 LIBS += -lQSsh
 
 SOURCES += *.cpp
@@ -73,9 +73,14 @@ Screen::Screen(int l, int c)
     : lines(l),
       columns(c),
       screenLines(new ImageLine[lines+1] ),
+      _imageTop(0),
       _scrolledLines(0),
       _droppedLines(0),
+      _changeSerial(0),
+      _imageSerial(0),
       history(new HistoryScrollNone()),
+      _historyLinesAdded(0),
+      _extendedChars(0),
       cuX(0), cuY(0),
       currentRendition(0),
       _topMargin(0), _bottomMargin(0),
@@ -84,9 +89,17 @@ Screen::Screen(int l, int c)
       effectiveForeground(CharacterColor()), effectiveBackground(CharacterColor()), effectiveRendition(0),
       lastPos(-1)
 {
+#ifdef SCREEN_CELL_GRID
+    allocateCellGrid(screenLines,lines+1,columns);
+#endif
+
     lineProperties.resize(lines+1);
+    _lineSerials.resize(lines+1);
     for (int i=0;i<lines+1;i++)
+    {
         lineProperties[i]=LINE_DEFAULT;
+        _lineSerials[i]=0;
+    }
 
     initTabStops();
     clearSelection();
@@ -99,9 +112,62 @@ Screen::Screen(int l, int c)
 Screen::~Screen()
 {
     delete[] screenLines;
+#ifdef SCREEN_CELL_GRID
+    delete[] _cellGrid;
+#endif
     delete history;
 }
 
+#ifdef SCREEN_CELL_GRID
+void Screen::allocateCellGrid(ImageLine* lineArray, int lineCount, int stride)
+{
+    _cellGrid = new Character[lineCount*stride];
+    _cellGridStride = stride;
+
+    for (int i=0;i<lineCount;i++)
+        lineArray[i].setRow(_cellGrid + i*stride, stride);
+}
+
+void CellGridLine::resize(int size)
+{
+    Q_ASSERT( size >= 0 );
+
+    size = qMin(size,_capacity);
+    for (int i=_length;i<size;i++)
+        _cells[i] = Character();
+    _length = size;
+}
+
+void CellGridLine::insert(int i, int n, const Character& c)
+{
+    Q_ASSERT( i >= 0 && i <= _length && n >= 0 );
+
+    n = qMin(n,_capacity-i);
+    const int kept = qMin(_length,_capacity-n) - i;
+    if (kept > 0)
+        memmove(_cells+i+n, _cells+i, kept*sizeof(Character));
+    for (int k=i;k<i+n;k++)
+        _cells[k] = c;
+    _length = qMin(_length+n,_capacity);
+}
+
+void CellGridLine::remove(int i, int n)
+{
+    Q_ASSERT( i >= 0 && n >= 0 && i+n <= _length );
+
+    memmove(_cells+i, _cells+i+n, (_length-i-n)*sizeof(Character));
+    _length -= n;
+}
+
+CellGridLine& CellGridLine::operator=(const CellGridLine& other)
+{
+    _length = qMin(other._length,_capacity);
+    if (_length > 0)
+        memcpy(_cells, other._cells, _length*sizeof(Character));
+    return *this;
+}
+#endif
+
 void Screen::cursorUp(int n)
 //=CUU
 {
@@ -201,30 +267,37 @@ void Screen::deleteChars(int n)
     if (n == 0)
         n = 1;
 
+    ImageLine& line = imageLine(cuY);
+
     // if cursor is beyond the end of the line there is nothing to do
-    if ( cuX >= screenLines[cuY].count() )
+    if ( cuX >= line.count() )
         return;
 
-    if ( cuX+n > screenLines[cuY].count() )
-        n = screenLines[cuY].count() - cuX;
+    if ( cuX+n > line.count() )
+        n = line.count() - cuX;
 
     Q_ASSERT( n >= 0 );
-    Q_ASSERT( cuX+n <= screenLines[cuY].count() );
+    Q_ASSERT( cuX+n <= line.count() );
 
-    screenLines[cuY].remove(cuX,n);
+    line.remove(cuX,n);
+    setLinesChanged(cuY,cuY);
 }
 
 void Screen::insertChars(int n)
 {
     if (n == 0) n = 1; // Default
 
-    if ( screenLines[cuY].size() < cuX )
-        screenLines[cuY].resize(cuX);
+    ImageLine& line = imageLine(cuY);
+
+    if ( line.size() < cuX )
+        line.resize(cuX);
 
-    screenLines[cuY].insert(cuX,n,' ');
+    line.insert(cuX,n,' ');
 
-    if ( screenLines[cuY].count() > columns )
-        screenLines[cuY].resize(columns);
+    if ( line.count() > columns )
+        line.resize(columns);
+
+    setLinesChanged(cuY,cuY);
 }
 
 void Screen::deleteLines(int n)
@@ -241,6 +314,9 @@ void Screen::insertLines(int n)
 
 void Screen::setMode(int m)
 {
+    if (m == MODE_Screen && !currentModes[m])
+        setImageChanged();
+
     currentModes[m] = true;
     switch(m)
     {
@@ -250,6 +326,9 @@ void Screen::setMode(int m)
 
 void Screen::resetMode(int m)
 {
+    if (m == MODE_Screen && currentModes[m])
+        setImageChanged();
+
     currentModes[m] = false;
     switch(m)
     {
@@ -264,6 +343,9 @@ void Screen::saveMode(int m)
 
 void Screen::restoreMode(int m)
 {
+    if (m == MODE_Screen && currentModes[m] != savedModes[m])
+        setImageChanged();
+
     currentModes[m] = savedModes[m];
 }
 
@@ -306,20 +388,44 @@ void Screen::resizeImage(int new_lines, int new_columns)
 
     // create new screen lines and copy from old to new
 
+    // the new image starts unrotated
     ImageLine* newScreenLines = new ImageLine[new_lines+1];
+#ifdef SCREEN_CELL_GRID
+    // lines are not truncated when the image becomes narrower,
+    // so the rows of the new grid must be able to hold them
+    Character* oldCellGrid = _cellGrid;
+    int newStride = new_columns;
     for (int i=0; i < qMin(lines,new_lines+1) ;i++)
-        newScreenLines[i]=screenLines[i];
+        newStride = qMax(newStride,imageLine(i).size());
+    allocateCellGrid(newScreenLines,new_lines+1,newStride);
+#endif
+    QVarLengthArray<LineProperty,64> newLineProperties(new_lines+1);
+    for (int i=0; i < qMin(lines,new_lines+1) ;i++)
+    {
+        newScreenLines[i] = imageLine(i);
+        newLineProperties[i] = imageLineProperty(i);
+    }
     for (int i=lines;(i > 0) && (i<new_lines+1);i++)
+    {
         newScreenLines[i].resize( new_columns );
+        newLineProperties[i] = LINE_DEFAULT;
+    }
 
-    lineProperties.resize(new_lines+1);
-    for (int i=lines;(i > 0) && (i<new_lines+1);i++)
-        lineProperties[i] = LINE_DEFAULT;
+    lineProperties = newLineProperties;
+    _imageTop = 0;
+
+    _lineSerials.resize(new_lines+1);
+    for (int i=0; i < new_lines+1; i++)
+        _lineSerials[i] = _changeSerial;
+    setImageChanged();
 
     clearSelection();
 
     delete[] screenLines;
     screenLines = newScreenLines;
+#ifdef SCREEN_CELL_GRID
+    delete[] oldCellGrid;
+#endif
 
     lines = new_lines;
     columns = new_columns;
@@ -435,21 +541,24 @@ void Screen::copyFromScreen(Character* dest , int startLine , int count) const
 
     for (int line = startLine; line < (startLine+count) ; line++)
     {
-        int srcLineStartIndex  = line*columns;
-        int destLineStartIndex = (line-startLine)*columns;
+        const ImageLine& srcLine = imageLine(line);
+        const int length = qMin(columns,srcLine.size());
+        Character* destLine = dest + (line-startLine)*columns;
 
-        for (int column = 0; column < columns; column++)
-        {
-            int srcIndex = srcLineStartIndex + column;
-            int destIndex = destLineStartIndex + column;
-
-            dest[destIndex] = screenLines[srcIndex/columns].value(srcIndex%columns,defaultChar);
+        if (length > 0)
+            memcpy(destLine, srcLine.constData(), length*sizeof(Character));
+        for (int column = length; column < columns; column++)
+            destLine[column] = defaultChar;
 
-            // invert selected text
-            if (selBegin != -1 && isSelected(column,line + history->getLines()))
-                reverseRendition(dest[destIndex]);
+        // invert selected text
+        if (selBegin != -1)
+        {
+            for (int column = 0; column < columns; column++)
+            {
+                if (isSelected(column,line + history->getLines()))
+                    reverseRendition(destLine[column]);
+            }
         }
-
     }
 }
 
@@ -484,8 +593,9 @@ void Screen::getImage( Character* dest, int size, int startLine, int endLine ) c
     }
 
     // mark the character at the current cursor position
-    int cursorIndex = loc(cuX, cuY + linesInHistoryBuffer);
-    if(getMode(MODE_Cursor) && cursorIndex < columns*mergedLines)
+    // (startLine may also be a line of the screen image)
+    int cursorIndex = loc(cuX, cuY + history->getLines() - startLine);
+    if(getMode(MODE_Cursor) && cursorIndex >= 0 && cursorIndex < columns*mergedLines)
         dest[cursorIndex].rendition |= RE_CURSOR;
 }
 
@@ -516,7 +626,7 @@ QVector<LineProperty> Screen::getLineProperties( int startLine , int endLine ) c
     const int firstScreenLine = startLine + linesInHistory - history->getLines();
     for (int line = firstScreenLine; line < firstScreenLine+linesInScreen; line++)
     {
-        result[index]=lineProperties[line];
+        result[index]=imageLineProperty(line);
         index++;
     }
 
@@ -553,11 +663,16 @@ void Screen::backspace()
     cuX = qMin(columns-1,cuX); // nowrap!
     cuX = qMax(0,cuX-1);
 
-    if (screenLines[cuY].size() < cuX+1)
-        screenLines[cuY].resize(cuX+1);
+    ImageLine& line = imageLine(cuY);
+
+    if (line.size() < cuX+1)
+        line.resize(cuX+1);
 
     if (BS_CLEARS)
-        screenLines[cuY][cuX].character = ' ';
+    {
+        line[cuX].character = ' ';
+        setLinesChanged(cuY,cuY);
+    }
 }
 
 void Screen::tab(int n)
@@ -623,7 +738,7 @@ void Screen::checkSelection(int from, int to)
         clearSelection();
 }
 
-void Screen::displayCharacter(unsigned short c)
+void Screen::displayCharacter(uint c)
 {
     // Note that VT100 does wrapping BEFORE putting the character.
     // This has impact on the assumption of valid cursor positions.
@@ -631,23 +746,30 @@ void Screen::displayCharacter(unsigned short c)
     // putting the cursor one right to the last column of the screen.
 
     int w = konsole_wcwidth(c);
-    if (w <= 0)
+    if (w == 0)
+    {
+        combineCharacter(c);
+        return;
+    }
+    if (w < 0)
         return;
 
     if (cuX+w > columns) {
         if (getMode(MODE_Wrap)) {
-            lineProperties[cuY] = (LineProperty)(lineProperties[cuY] | LINE_WRAPPED);
+            imageLineProperty(cuY) = (LineProperty)(imageLineProperty(cuY) | LINE_WRAPPED);
             nextLine();
         }
         else
             cuX = columns-w;
     }
 
+    ImageLine& line = imageLine(cuY);
+
     // ensure current line vector has enough elements
-    int size = screenLines[cuY].size();
+    int size = line.size();
     if (size < cuX+w)
     {
-        screenLines[cuY].resize(cuX+w);
+        line.resize(cuX+w);
     }
 
     if (getMode(MODE_Insert)) insertChars(w);
@@ -657,7 +779,9 @@ void Screen::displayCharacter(unsigned short c)
     // check if selection is still valid.
     checkSelection(lastPos, lastPos);
 
-    Character& currentChar = screenLines[cuY][cuX];
+    Character& currentChar = line[cuX];
+
+    setLinesChanged(cuY,cuY);
 
     currentChar.character = c;
     currentChar.foregroundColor = effectiveForeground;
@@ -670,10 +794,10 @@ void Screen::displayCharacter(unsigned short c)
     {
         i++;
 
-        if ( screenLines[cuY].size() < cuX + i + 1 )
-            screenLines[cuY].resize(cuX+i+1);
+        if ( line.size() < cuX + i + 1 )
+            line.resize(cuX+i+1);
 
-        Character& ch = screenLines[cuY][cuX + i];
+        Character& ch = line[cuX + i];
         ch.character = 0;
         ch.foregroundColor = effectiveForeground;
         ch.backgroundColor = effectiveBackground;
@@ -684,6 +808,143 @@ void Screen::displayCharacter(unsigned short c)
     cuX = newCursorX;
 }
 
+void Screen::combineCharacter(uint c)
+{
+    if (!_extendedChars)
+        return;
+
+    // the character before the cursor may be at the end of the previous
+    // line if the cursor wrapped onto this one
+    int x = cuX;
+    int y = cuY;
+    if (x == 0)
+    {
+        if (y == 0 || !(imageLineProperty(y-1) & LINE_WRAPPED))
+            return;
+        y--;
+        x = columns;
+    }
+
+    ImageLine& line = imageLine(y);
+    x = qMin(x, line.size()) - 1;
+
+    // skip back over the trailing part of a wide character
+    if (x > 0 && line[x].character == 0 && !(line[x].rendition & RE_EXTENDED_CHAR))
+        x--;
+    if (x < 0)
+        return;
+
+    Character& currentChar = line[x];
+    uint sequence[ExtendedCharTable::MaxSequenceLength];
+    int length = 1;
+    if (currentChar.rendition & RE_EXTENDED_CHAR)
+    {
+        const uint* chars = _extendedChars->lookupExtendedChar(currentChar.character, length);
+        if (!chars || length == ExtendedCharTable::MaxSequenceLength)
+            return;
+        memcpy(sequence, chars, length * sizeof(uint));
+    }
+    else
+    {
+        sequence[0] = currentChar.character;
+    }
+    sequence[length++] = c;
+
+    const uint key = _extendedChars->createExtendedChar(sequence, length);
+    if (key == ExtendedCharTable::InvalidKey)
+        return;
+
+    currentChar.character = key;
+    currentChar.rendition |= RE_EXTENDED_CHAR;
+    setLinesChanged(y,y);
+}
+
+void Screen::setExtendedCharTable(ExtendedCharTable* table)
+{
+    _extendedChars = table;
+}
+
+void Screen::markExtendedChars(ExtendedCharTable& table) const
+{
+    for (int y = 0; y <= lines; y++)
+    {
+        const ImageLine& line = imageLine(y);
+        for (int x = 0; x < line.size(); x++)
+        {
+            if (line[x].rendition & RE_EXTENDED_CHAR)
+                table.markExtendedChar(line[x].character);
+        }
+    }
+
+    // the history can be very long, only the lines which were seen to
+    // contain extended characters when they were added are read back
+    const qint64 firstLine = _historyLinesAdded - history->getLines();
+    QVector<Character> cells;
+    foreach (qint64 line, _extendedHistoryLines)
+    {
+        const int y = int(line - firstLine);
+        if (y < 0)
+            continue;
+
+        const int length = history->getLineLen(y);
+        cells.resize(length);
+        history->getCells(y, 0, length, cells.data());
+        for (int x = 0; x < length; x++)
+        {
+            if (cells[x].rendition & RE_EXTENDED_CHAR)
+                table.markExtendedChar(cells[x].character);
+        }
+    }
+}
+
+// printable ASCII is always a single column wide, avoid the width lookup for it
+static inline bool isSingleWidth(uint c)
+{
+    if (c >= 0x20 && c < 0x7f)
+        return true;
+    return konsole_wcwidth(c) == 1;
+}
+
+void Screen::displayCharacters(const uint* text, int count)
+{
+    int i = 0;
+    while (i < count)
+    {
+        // wide and zero-width characters, insert mode and a pending wrap
+        // at the right margin are left to displayCharacter()
+        if (cuX >= columns || getMode(MODE_Insert) || !isSingleWidth(text[i]))
+        {
+            displayCharacter(text[i++]);
+            continue;
+        }
+
+        int run = 1;
+        const int maxRun = qMin(count - i, columns - cuX);
+        while (run < maxRun && isSingleWidth(text[i + run]))
+            run++;
+
+        ImageLine& line = imageLine(cuY);
+        if (line.size() < cuX + run)
+            line.resize(cuX + run);
+
+        checkSelection(loc(cuX, cuY), loc(cuX + run - 1, cuY));
+        setLinesChanged(cuY, cuY);
+
+        Character* cell = line.data() + cuX;
+        for (int j = 0; j < run; j++, cell++)
+        {
+            cell->character = text[i + j];
+            cell->foregroundColor = effectiveForeground;
+            cell->backgroundColor = effectiveBackground;
+            cell->rendition = effectiveRendition;
+        }
+
+        i += run;
+        cuX += run;
+        lastPos = loc(cuX - 1, cuY);
+    }
+}
+
 void Screen::compose(QString /*compose*/)
 {
     Q_ASSERT( 0 /*Not implemented yet*/ );
@@ -819,14 +1080,16 @@ void Screen::clearImage(int loca, int loce, char c)
     //default character, the affected lines can simply be shrunk.
     bool isDefaultCh = (clearCh == Character());
 
+    setLinesChanged(topLine,bottomLine);
+
     for (int y=topLine;y<=bottomLine;y++)
     {
-        lineProperties[y] = 0;
+        imageLineProperty(y) = 0;
 
         int endCol = ( y == bottomLine) ? loce%columns : columns-1;
         int startCol = ( y == topLine ) ? loca%columns : 0;
 
-        QVector<Character>& line = screenLines[y];
+        ImageLine& line = imageLine(y);
 
         if ( isDefaultCh && endCol == columns-1 )
         {
@@ -834,7 +1097,9 @@ void Screen::clearImage(int loca, int loce, char c)
         }
         else
         {
-            if (line.size() < endCol + 1)
+            // clearing up to the right edge also drops anything beyond it
+            // (left over from a wider image), as the shrinking above does
+            if (line.size() < endCol + 1 || endCol == columns-1)
                 line.resize(endCol+1);
 
             Character* data = line.data();
@@ -849,26 +1114,46 @@ void Screen::moveImage(int dest, int sourceBegin, int sourceEnd)
     Q_ASSERT( sourceBegin <= sourceEnd );
 
     int lines=(sourceEnd-sourceBegin)/columns;
+    const int destLine = dest/columns;
+    const int sourceLine = sourceBegin/columns;
+
+    setLinesChanged(destLine,destLine+lines);
 
     //move screen image and line properties:
     //the source and destination areas of the image may overlap,
     //so it matters that we do the copy in the right order -
     //forwards if dest < sourceBegin or backwards otherwise.
     //(search the web for 'memmove implementation' for details)
-    if (dest < sourceBegin)
+    //
+    //lines are swapped rather than assigned, so that no two lines share
+    //their data (which would force a reallocation on the next write) and
+    //the vacated lines, which the caller clears, keep their storage.
+    //
+    //if the moved block reaches from one edge of the screen to the
+    //other (eg. when scrolling without margins), the rings are rotated
+    //instead.  the lines which wrap around are the vacated ones.
+    if (destLine < sourceLine && destLine == 0 && sourceLine+lines == this->lines-1)
+    {
+        _imageTop = imageIndex(sourceLine);
+    }
+    else if (destLine > sourceLine && sourceLine == 0 && destLine+lines == this->lines-1)
+    {
+        _imageTop = imageIndex(this->lines - destLine);
+    }
+    else if (dest < sourceBegin)
     {
         for (int i=0;i<=lines;i++)
         {
-            screenLines[ (dest/columns)+i ] = screenLines[ (sourceBegin/columns)+i ];
-            lineProperties[(dest/columns)+i]=lineProperties[(sourceBegin/columns)+i];
+            imageLine(destLine+i).swap(imageLine(sourceLine+i));
+            imageLineProperty(destLine+i)=imageLineProperty(sourceLine+i);
         }
     }
     else
     {
         for (int i=lines;i>=0;i--)
         {
-            screenLines[ (dest/columns)+i ] = screenLines[ (sourceBegin/columns)+i ];
-            lineProperties[(dest/columns)+i]=lineProperties[(sourceBegin/columns)+i];
+            imageLine(destLine+i).swap(imageLine(sourceLine+i));
+            imageLineProperty(destLine+i)=imageLineProperty(sourceLine+i);
         }
     }
 
@@ -1005,6 +1290,9 @@ void Screen::setBackColor(int space, int color)
 
 void Screen::clearSelection() 
 {
+    if (selTopLeft != -1 || selBottomRight != -1)
+        setImageChanged();
+
     selBottomRight = -1;
     selTopLeft = -1;
     selBegin = -1;
@@ -1045,6 +1333,7 @@ void Screen::setSelectionStart(const int x, const int y, const bool mode)
     selBottomRight = selBegin;
     selTopLeft = selBegin;
     blockSelectionMode = mode;
+    setImageChanged();
 }
 
 void Screen::setSelectionEnd( const int x, const int y)
@@ -1080,6 +1369,8 @@ void Screen::setSelectionEnd( const int x, const int y)
         selTopLeft = loc(qMin(topColumn,bottomColumn),topRow);
         selBottomRight = loc(qMax(topColumn,bottomColumn),bottomRow);
     }
+
+    setImageChanged();
 }
 
 bool Screen::isSelected( const int x,const int y) const
@@ -1125,6 +1416,8 @@ void Screen::writeToStream(TerminalCharacterDecoder* decoder,
                            int startIndex, int endIndex,
                            bool preserveLineBreaks) const
 {
+    decoder->setExtendedCharTable(_extendedChars);
+
     int top = startIndex / columns;
     int left = startIndex % columns;
 
@@ -1220,8 +1513,8 @@ int Screen::copyLineToStream(int line ,
 
         const int screenLine = line-history->getLines();
 
-        Character* data = screenLines[screenLine].data();
-        int length = screenLines[screenLine].count();
+        const Character* data = imageLine(screenLine).constData();
+        int length = imageLine(screenLine).count();
 
         //retrieve line from screen image
         for (int i=start;i < qMin(start+count,length);i++)
@@ -1232,8 +1525,8 @@ int Screen::copyLineToStream(int line ,
         // count cannot be any greater than length
         count = qBound(0,count,length-start);
 
-        Q_ASSERT( screenLine < lineProperties.count() );
-        currentLineProperties |= lineProperties[screenLine];
+        Q_ASSERT( screenLine <= lines );
+        currentLineProperties |= imageLineProperty(screenLine);
     }
 
     // add new line character at end
@@ -1267,8 +1560,20 @@ void Screen::addHistLine()
     {
         int oldHistLines = history->getLines();
 
-        history->addCellsVector(screenLines[0]);
-        history->addLine( lineProperties[0] & LINE_WRAPPED );
+        const ImageLine& topLine = imageLine(0);
+        history->addCells(topLine.constData(),topLine.size());
+        history->addLine( imageLineProperty(0) & LINE_WRAPPED );
+
+        for (int x = 0; x < topLine.size(); x++)
+        {
+            if (topLine[x].rendition & RE_EXTENDED_CHAR)
+            {
+                _extendedHistoryLines << _historyLinesAdded;
+                break;
+            }
+        }
+        _historyLinesAdded++;
+        dropExtendedHistoryLines();
 
         int newHistLines = history->getLines();
 
@@ -1317,6 +1622,35 @@ void Screen::addHistLine()
 
 }
 
+void Screen::dropExtendedHistoryLines()
+{
+    const qint64 firstLine = _historyLinesAdded - history->getLines();
+    while (!_extendedHistoryLines.isEmpty() && _extendedHistoryLines.first() < firstLine)
+        _extendedHistoryLines.removeFirst();
+}
+
+void Screen::findExtendedHistoryLines()
+{
+    _extendedHistoryLines.clear();
+    _historyLinesAdded = history->getLines();
+
+    QVector<Character> cells;
+    for (int y = 0; y < history->getLines(); y++)
+    {
+        const int length = history->getLineLen(y);
+        cells.resize(length);
+        history->getCells(y, 0, length, cells.data());
+        for (int x = 0; x < length; x++)
+        {
+            if (cells[x].rendition & RE_EXTENDED_CHAR)
+            {
+                _extendedHistoryLines << y;
+                break;
+            }
+        }
+    }
+}
+
 int Screen::getHistLines() const
 {
     return history->getLines();
@@ -1334,6 +1668,11 @@ void Screen::setScroll(const HistoryType& t , bool copyPreviousScroll)
         history = t.scroll(0);
         delete oldScroll;
     }
+
+    // which of the old lines the new scroll keeps depends on its type, so
+    // they are looked for again.  this only happens when the history type
+    // is changed, not while output arrives
+    findExtendedHistoryLines();
 }
 
 bool Screen::hasScroll() const
@@ -1349,9 +1688,18 @@ const HistoryType& Screen::getScroll() const
 void Screen::setLineProperty(LineProperty property , bool enable)
 {
     if ( enable )
-        lineProperties[cuY] = (LineProperty)(lineProperties[cuY] | property);
+        imageLineProperty(cuY) = (LineProperty)(imageLineProperty(cuY) | property);
     else
-        lineProperties[cuY] = (LineProperty)(lineProperties[cuY] & ~property);
+        imageLineProperty(cuY) = (LineProperty)(imageLineProperty(cuY) & ~property);
+
+    setLinesChanged(cuY,cuY);
+}
+
+void Screen::setLinesChanged(int topLine, int bottomLine)
+{
+    const quint64 serial = ++_changeSerial;
+    for (int line = topLine; line <= bottomLine; line++)
+        _lineSerials[line] = serial;
 }
 void Screen::fillWithDefaultChar(Character* dest, int count)
 {
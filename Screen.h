@@ -46,6 +46,71 @@ class TerminalCharacterDecoder;
 #include <QTextStream>
 #include <QVarLengthArray>
 
+#ifdef SCREEN_CELL_GRID
+/**
+ * A line of the screen image when the image is stored as one contiguous
+ * grid of cells (see SCREEN_CELL_GRID).
+ *
+ * Each line is bound to a fixed-size row of the grid and tracks how many
+ * cells of the row are in use, just like the size of a QVector<Character>.
+ * It provides the part of the QVector API which Screen uses, so that either
+ * type can serve as Screen::ImageLine.  Assigning a line copies its cells,
+ * swapping two lines of the same grid exchanges their rows.
+ */
+class CellGridLine
+{
+public:
+    CellGridLine() : _cells(0), _length(0), _capacity(0) {}
+
+    /** Binds this line to a row of @p capacity cells starting at @p cells. */
+    void setRow(Character* cells, int capacity)
+    { _cells = cells; _length = 0; _capacity = capacity; }
+
+    int size() const { return _length; }
+    int count() const { return _length; }
+
+    Character* data() { return _cells; }
+    const Character* data() const { return _cells; }
+    const Character* constData() const { return _cells; }
+
+    Character& operator[](int i)
+    { Q_ASSERT( i >= 0 && i < _length ); return _cells[i]; }
+    const Character& operator[](int i) const
+    { Q_ASSERT( i >= 0 && i < _length ); return _cells[i]; }
+    Character value(int i, const Character& defaultValue) const
+    { return (i >= 0 && i < _length) ? _cells[i] : defaultValue; }
+
+    /**
+     * Sets the number of cells in use.  New cells are set to the default
+     * character.  The size is limited to the width of the row.
+     */
+    void resize(int size);
+    /**
+     * Inserts @p n copies of @p c at @p i.  Cells pushed beyond the end
+     * of the row are dropped.
+     */
+    void insert(int i, int n, const Character& c);
+    /** Removes @p n cells starting at @p i. */
+    void remove(int i, int n);
+
+    void swap(CellGridLine& other)
+    {
+        qSwap(_cells,other._cells);
+        qSwap(_length,other._length);
+        qSwap(_capacity,other._capacity);
+    }
+
+    CellGridLine& operator=(const CellGridLine& other);
+
+private:
+    CellGridLine(const CellGridLine&);
+
+    Character* _cells;
+    int _length;
+    int _capacity;
+};
+#endif
+
 /**
     \brief An image of characters with associated attributes.
 
@@ -342,7 +407,31 @@ public:
      * is inserted at the current cursor position, otherwise it will replace the
      * character already at the current cursor position.
      */
-    void displayCharacter(unsigned short c);
+    void displayCharacter(uint c);
+
+    /**
+     * Displays @p count characters from @p text at the current cursor position.
+     *
+     * This has the same effect as calling displayCharacter() for each character
+     * in turn, but runs of single-width characters which fit on the current line
+     * are written into the image in one pass.
+     */
+    void displayCharacters(const uint* text, int count);
+
+    /**
+     * Sets the table in which sequences of combining characters are stored.
+     * Zero-width characters are appended to the character before the cursor
+     * in this table, and dropped if no table is set.
+     */
+    void setExtendedCharTable(ExtendedCharTable* table);
+    /** Returns the table set with setExtendedCharTable() */
+    const ExtendedCharTable* extendedCharTable() const
+    { return _extendedChars; }
+    /**
+     * Marks the extended characters used by the screen image and the
+     * history as being in use.  See ExtendedCharTable::markExtendedChar()
+     */
+    void markExtendedChars(ExtendedCharTable& table) const;
     
     // Do composition with last shown character FIXME: Not implemented yet for KDE 4
     void compose(QString compose);
@@ -540,6 +629,31 @@ public:
      */
     void resetDroppedLines();
 
+    /**
+     * Returns a counter which advances whenever the screen image is modified.
+     * Pass the value to isLineChangedSince() later on to find out which lines
+     * have been modified in the meantime.
+     */
+    quint64 changeSerial() const { return _changeSerial; }
+
+    /**
+     * Returns true if the characters or attributes of screen line @p line
+     * (where 0 is the first line of the screen image, not of the history)
+     * may have changed since changeSerial() returned @p serial.
+     *
+     * Moving the cursor does not mark lines as changed, callers which show
+     * the cursor must keep track of its position themselves.
+     */
+    bool isLineChangedSince(int line, quint64 serial) const
+    { return lineChangeSerial(line) > serial; }
+
+    /**
+     * Returns the value of changeSerial() when screen line @p line was last
+     * modified, see isLineChangedSince()
+     */
+    quint64 lineChangeSerial(int line) const
+    { return qMax(_lineSerials[line],_imageSerial); }
+
     /**
       * Fills the buffer @p dest with @p count instances of the default (ie. blank)
       * Character style.
@@ -590,6 +704,10 @@ private:
     void scrollDown(int from, int i);
 
     void addHistLine();
+    // forgets the lines in _extendedHistoryLines which are no longer in the history
+    void dropExtendedHistoryLines();
+    // fills _extendedHistoryLines by reading the whole history
+    void findExtendedHistoryLines();
 
     void initTabStops();
 
@@ -622,18 +740,70 @@ private:
     int lines;
     int columns;
 
+#ifdef SCREEN_CELL_GRID
+    typedef CellGridLine ImageLine;            // [0..columns]
+#else
     typedef QVector<Character> ImageLine;      // [0..columns]
+#endif
     ImageLine*          screenLines;    // [lines]
+    int                 _imageTop;      // index of the first line in screenLines
+
+#ifdef SCREEN_CELL_GRID
+    // storage of screenLines, [lines+1] rows of _cellGridStride cells.
+    // rows are at least 'columns' wide, wider if lines were kept intact
+    // when the image was made narrower.
+    Character*          _cellGrid;
+    int                 _cellGridStride;
+
+    void allocateCellGrid(ImageLine* lineArray, int lineCount, int stride);
+#endif
 
     int _scrolledLines;
     QRect _lastScrolledRegion;
 
     int _droppedLines;
 
+    // change tracking, see isLineChangedSince()
+    // _lineSerials holds the value of _changeSerial when each screen line
+    // was last modified, _imageSerial when the whole image was last changed
+    // (resized, selection changed, ...)
+    quint64 _changeSerial;
+    quint64 _imageSerial;
+    QVarLengthArray<quint64,64> _lineSerials;
+
+    void setLinesChanged(int topLine, int bottomLine);
+    void setImageChanged() { _imageSerial = ++_changeSerial; }
+
     QVarLengthArray<LineProperty,64> lineProperties;
+
+    // screenLines and lineProperties are used as rings starting at
+    // _imageTop, so that scrolling the whole screen only moves the top.
+    // these map a line of the screen image to its entry in the rings.
+    // the extra line after the last one (which a cursor in the pending
+    // wrap position can address) is not part of the ring.
+    int imageIndex(int line) const
+    {
+        if (line >= lines) return line;
+        int index = _imageTop + line; return index < lines ? index : index - lines;
+    }
+    ImageLine& imageLine(int line) const
+    { return screenLines[imageIndex(line)]; }
+    LineProperty& imageLineProperty(int line)
+    { return lineProperties[imageIndex(line)]; }
+    LineProperty imageLineProperty(int line) const
+    { return lineProperties[imageIndex(line)]; }
     
     // history buffer ---------------
     HistoryScroll* history;
+    // number of lines added to the history so far, and the numbers (counted
+    // the same way) of the lines still in the history which contain extended
+    // characters.  markExtendedChars() only has to look at those
+    qint64 _historyLinesAdded;
+    QList<qint64> _extendedHistoryLines;
+
+    // appends the zero-width character 'c' to the character before the cursor
+    void combineCharacter(uint c);
+    ExtendedCharTable* _extendedChars;
     
     // cursor location
     int cuX;
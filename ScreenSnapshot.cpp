@@ -0,0 +1,124 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own includes
+#include "ScreenSnapshot.h"
+#include "Screen.h"
+
+ScreenSnapshot::ScreenSnapshot()
+    : frame(0)
+    , screen(0)
+    , lines(0)
+    , columns(0)
+    , historyLines(0)
+    , changeSerial(0)
+    , cursorVisible(false)
+    , cursorLine(-1)
+    , scrolledLines(0)
+    , droppedLines(0)
+{
+}
+
+void ScreenSnapshot::update(Screen* source, const ExtendedCharTable& table)
+{
+    const int newLines = source->getLines();
+    const int newColumns = source->getColumns();
+
+    // when the cursor is at the right margin waiting to wrap,
+    // Screen::getImage() draws it on the first character of the next line
+    const bool newCursorVisible = source->getMode(MODE_Cursor);
+    const int newCursorLine = newCursorVisible
+        ? (source->getCursorY() * newColumns + source->getCursorX()) / newColumns
+        : -1;
+
+    // the line serials of one screen mean nothing for another, and a
+    // resized screen has changed throughout
+    const bool fullUpdate = source != screen || newLines != lines || newColumns != columns;
+    if (fullUpdate)
+    {
+        image.resize(newLines * newColumns);
+        lineSerials.resize(newLines);
+    }
+
+    screen = source;
+    lines = newLines;
+    columns = newColumns;
+    historyLines = source->getHistLines();
+
+    int line = 0;
+    while (line < lines)
+    {
+        // copy runs of changed lines with one call
+        int end = line;
+        while (end < lines)
+        {
+            if (!fullUpdate && source->lineChangeSerial(end) <= changeSerial &&
+                end != cursorLine && end != newCursorLine)
+                break;
+            end++;
+        }
+
+        if (end > line)
+        {
+            source->getImage(image.data() + line*columns, (end-line)*columns,
+                             historyLines + line, historyLines + end - 1);
+            line = end;
+        }
+        else
+        {
+            line++;
+        }
+    }
+
+    for (line = 0; line < lines; line++)
+        lineSerials[line] = source->lineChangeSerial(line);
+    changeSerial = source->changeSerial();
+
+    lineProperties = source->getLineProperties(historyLines, historyLines + lines - 1);
+    extendedChars = table;
+
+    cursor = QPoint(source->getCursorX(), source->getCursorY());
+    cursorVisible = newCursorVisible;
+    cursorLine = newCursorLine;
+    lastScrolledRegion = source->lastScrolledRegion();
+}
+
+ScreenSnapshotBuffer::ScreenSnapshotBuffer()
+    : _front(0)
+    , _frames(0)
+    , _screenLock(QMutex::Recursive)
+{
+}
+
+void ScreenSnapshotBuffer::publish()
+{
+    back().frame = ++_frames;
+
+    QMutexLocker locker(&_frontLock);
+    _front = 1 - _front;
+}
+
+const ScreenSnapshot& ScreenSnapshotBuffer::acquire()
+{
+    _frontLock.lock();
+    return _snapshots[_front];
+}
+
+void ScreenSnapshotBuffer::release()
+{
+    _frontLock.unlock();
+}
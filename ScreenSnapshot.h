@@ -0,0 +1,128 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#pragma once
+
+// Own includes
+#include "Character.h"
+class Screen;
+
+// Qt includes
+#include <QMutex>
+#include <QPoint>
+#include <QRect>
+#include <QVector>
+
+/**
+ * A copy of the state of a terminal screen which views need to draw it,
+ * taken by the emulation at the end of each frame.
+ *
+ * The image only covers the lines of the screen, not the history.  Views
+ * which are scrolled back into the history read it from the screen itself
+ * while holding ScreenSnapshotBuffer::screenLock().
+ */
+class ScreenSnapshot
+{
+public:
+    ScreenSnapshot();
+
+    // number of the snapshot, counting from 1, set by publish()
+    quint64 frame;
+
+    // the screen which the snapshot was taken of
+    Screen* screen;
+    int lines;
+    int columns;
+    int historyLines;
+
+    // the screen image with the cursor and selection applied, as returned
+    // by Screen::getImage(), and the properties of its lines
+    QVector<Character> image;
+    QVector<LineProperty> lineProperties;
+
+    // Screen::changeSerial() when the snapshot was taken, and the serial
+    // of the last change of each line, see Screen::lineChangeSerial()
+    quint64 changeSerial;
+    QVector<quint64> lineSerials;
+
+    // the sequences of the extended characters in the image, shared with
+    // the emulation's table until either is modified
+    ExtendedCharTable extendedChars;
+
+    QPoint cursor;
+    bool cursorVisible;
+    // the line of the image on which Screen::getImage() draws the cursor,
+    // or -1 when it is hidden
+    int cursorLine;
+
+    QRect lastScrolledRegion;
+    // number of lines scrolled and dropped from the history since the
+    // emulation was created.  views keep the values they saw last, so
+    // that frames which they skip are still accounted for
+    qint64 scrolledLines;
+    qint64 droppedLines;
+
+    /**
+     * Updates the snapshot to the current state of @p screen, copying only
+     * the lines which have changed since the snapshot was last taken.
+     * The screen must not be modified while this is running.
+     */
+    void update(Screen* screen, const ExtendedCharTable& extendedChars);
+};
+
+/**
+ * Passes screen snapshots from the thread running the emulation to the
+ * views on the GUI thread.
+ *
+ * The emulation updates the back buffer at its own pace and publishes it
+ * with publish(), which makes it the front buffer.  Views read the front
+ * buffer between acquire() and release().  The lock is only held to swap
+ * the buffers and to copy out of the front one, so neither side waits for
+ * the other to parse output or to paint.
+ */
+class ScreenSnapshotBuffer
+{
+public:
+    ScreenSnapshotBuffer();
+
+    /** Returns the snapshot which the emulation updates next. */
+    ScreenSnapshot& back() { return _snapshots[1 - _front]; }
+
+    /** Makes back() the snapshot which is handed to the views. */
+    void publish();
+
+    /**
+     * Locks the snapshot published last and returns it.  Callers must
+     * call release() as soon as they are done with it.
+     */
+    const ScreenSnapshot& acquire();
+    void release();
+
+    /**
+     * Returns the lock which the emulation holds while it modifies its
+     * screens.  Views hold it when they need to access a screen directly,
+     * for example to read the history or to change the selection.
+     */
+    QMutex* screenLock() { return &_screenLock; }
+
+private:
+    ScreenSnapshot _snapshots[2];
+    int _front;
+    quint64 _frames;
+    QMutex _frontLock;
+    QMutex _screenLock;
+};
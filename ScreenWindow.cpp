@@ -27,15 +27,33 @@
 // Own includes
 #include "ScreenWindow.h"
 #include "Screen.h"
+#include "ScreenSnapshot.h"
+
+// System includes
+#include <string.h>
 
 // Qt includes
+#include <QMutexLocker>
 #include <QtDebug>
 
 ScreenWindow::ScreenWindow(QObject* parent)
     : QObject(parent)
+    , _snapshots(0)
+    , _frame(0)
+    , _screen(0)
+    , _lines(0)
+    , _columns(0)
+    , _historyLines(0)
+    , _scrolledLines(0)
+    , _droppedLines(0)
     , _windowBuffer(0)
     , _windowBufferSize(0)
     , _bufferNeedsUpdate(true)
+    , _bufferNeedsFullUpdate(true)
+    , _changeSerial(0)
+    , _firstScreenLine(-1)
+    , _cursorLine(-1)
+    , _extendedCharsReused(false)
     , _windowLines(1)
     , _currentLine(0)
     , _trackOutput(true)
@@ -46,11 +64,20 @@ ScreenWindow::~ScreenWindow()
 {
     delete[] _windowBuffer;
 }
-void ScreenWindow::setScreen(Screen* screen)
+void ScreenWindow::setSnapshotBuffer(ScreenSnapshotBuffer* buffer)
 {
-    Q_ASSERT( screen );
+    Q_ASSERT( buffer );
+
+    _snapshots = buffer;
 
-    _screen = screen;
+    const ScreenSnapshot& snapshot = _snapshots->acquire();
+    _scrolledLines = snapshot.scrolledLines;
+    _droppedLines = snapshot.droppedLines;
+    syncWithSnapshot(snapshot);
+    _snapshots->release();
+
+    _bufferNeedsUpdate = true;
+    _bufferNeedsFullUpdate = true;
 }
 
 Screen* ScreenWindow::screen() const
@@ -58,40 +85,189 @@ Screen* ScreenWindow::screen() const
     return _screen;
 }
 
+// takes over the state of the screen from 'snapshot' and moves the window
+// along with the output
+void ScreenWindow::syncWithSnapshot(const ScreenSnapshot& snapshot)
+{
+    if (snapshot.screen != _screen || snapshot.lines != _lines || snapshot.columns != _columns)
+    {
+        _bufferNeedsUpdate = true;
+        _bufferNeedsFullUpdate = true;
+    }
+
+    _screen = snapshot.screen;
+    _lines = snapshot.lines;
+    _columns = snapshot.columns;
+    _historyLines = snapshot.historyLines;
+    _cursor = snapshot.cursor;
+    _lastScrolledRegion = snapshot.lastScrolledRegion;
+
+    const int scrolledLines = int(snapshot.scrolledLines - _scrolledLines);
+    const int droppedLines = int(snapshot.droppedLines - _droppedLines);
+    _scrolledLines = snapshot.scrolledLines;
+    _droppedLines = snapshot.droppedLines;
+
+    // move window to the bottom of the screen and update scroll count
+    // if this window is currently tracking the bottom of the screen
+    if ( _trackOutput )
+    {
+        _scrollCount -= scrolledLines;
+        _currentLine = qMax(0,_historyLines - (windowLines()-_lines));
+    }
+    else
+    {
+        // if the history is not unlimited then it may
+        // have run out of space and dropped the oldest
+        // lines of output - in this case the screen
+        // window's current line number will need to
+        // be adjusted - otherwise the output will scroll
+        _currentLine = qMax(0,_currentLine - droppedLines);
+
+        // ensure that the screen window's current position does
+        // not go beyond the bottom of the screen
+        _currentLine = qMin( _currentLine , _historyLines );
+    }
+}
+
 Character* ScreenWindow::getImage()
 {
-    // reallocate internal buffer if the window size has changed
     int size = windowLines() * windowColumns();
+    if (_windowBuffer != 0 && _windowBufferSize == size && !_bufferNeedsUpdate)
+        return _windowBuffer;
+
+    const ScreenSnapshot& snapshot = _snapshots->acquire();
+    syncWithSnapshot(snapshot);
+
+    // reallocate internal buffer if the window size has changed
+    size = windowLines() * windowColumns();
     if (_windowBuffer == 0 || _windowBufferSize != size)
     {
         delete[] _windowBuffer;
         _windowBufferSize = size;
         _windowBuffer = new Character[size];
-        _bufferNeedsUpdate = true;
+        _bufferNeedsFullUpdate = true;
     }
 
-    if (!_bufferNeedsUpdate)
-        return _windowBuffer;
+    const int firstScreenLine = currentLine() - _historyLines;
+    if (firstScreenLine >= 0)
+    {
+        copyFromSnapshot(snapshot, firstScreenLine);
+        _snapshots->release();
+    }
+    else
+    {
+        // the snapshot does not include the history, which has to be
+        // read from the screen
+        _snapshots->release();
+        copyFromScreen();
+    }
+
+    _bufferNeedsUpdate = false;
+    _bufferNeedsFullUpdate = false;
+    return _windowBuffer;
+}
 
-    _screen->getImage(_windowBuffer,size,
-                      currentLine(),endWindowLine());
+void ScreenWindow::copyFromSnapshot(const ScreenSnapshot& snapshot, int firstScreenLine)
+{
+    const int columns = windowColumns();
+    const int lines = qMin(windowLines(),_lines - firstScreenLine);
+
+    // if the window still shows the same part of the screen image as last
+    // time, only the lines which have changed since then need to be copied
+    // after a collection of the extended characters a line which has
+    // not changed may still hold keys which now stand for other text
+    if (snapshot.extendedChars.collections() != _extendedChars.collections())
+        _extendedCharsReused = true;
+
+    const bool fullUpdate = _bufferNeedsFullUpdate || firstScreenLine != _firstScreenLine ||
+                            _changedLines.size() != windowLines() || _extendedCharsReused;
+    if (fullUpdate)
+        _changedLines.fill(true,windowLines());
+
+    for (int line = 0; line < lines; line++)
+    {
+        const int screenLine = firstScreenLine + line;
+        if (!fullUpdate && snapshot.lineSerials[screenLine] <= _changeSerial &&
+            screenLine != _cursorLine && screenLine != snapshot.cursorLine)
+            continue;
+
+        memcpy(_windowBuffer + line*columns, snapshot.image.constData() + screenLine*columns,
+               columns * sizeof(Character));
+        _changedLines.setBit(line);
+    }
 
     // this window may look beyond the end of the screen, in which
     // case there will be an unused area which needs to be filled
     // with blank characters
-    fillUnusedArea();
+    if (fullUpdate)
+        fillUnusedArea(lines);
 
-    _bufferNeedsUpdate = false;
-    return _windowBuffer;
+    _lineProperties = snapshot.lineProperties.mid(firstScreenLine, lines);
+    _lineProperties.resize(windowLines());
+    _extendedChars = snapshot.extendedChars;
+
+    _changeSerial = snapshot.changeSerial;
+    _firstScreenLine = firstScreenLine;
+    _cursorLine = snapshot.cursorLine;
 }
 
-void ScreenWindow::fillUnusedArea()
+void ScreenWindow::copyFromScreen()
 {
-    int screenEndLine = _screen->getHistLines() + _screen->getLines() - 1;
-    int windowEndLine = currentLine() + windowLines() - 1;
+    QMutexLocker locker(_snapshots->screenLock());
 
-    int unusedLines = windowEndLine - screenEndLine;
-    int charsToFill = unusedLines * windowColumns();
+    _changedLines.fill(true,windowLines());
+    _firstScreenLine = -1;
+
+    // the screen has been resized since the last snapshot, wait for
+    // the next one rather than reading it with a different size
+    if (_screen->getLines() != _lines || _screen->getColumns() != _columns)
+    {
+        fillUnusedArea(0);
+        _lineProperties.fill(LINE_DEFAULT,windowLines());
+        return;
+    }
+
+    // the history may have been cleared since the last snapshot
+    const int endLine = qMin(currentLine() + windowLines() - 1,
+                             _screen->getHistLines() + _screen->getLines() - 1);
+    const int usedLines = qMax(0,endLine - currentLine() + 1);
+    if (usedLines > 0)
+    {
+        _screen->getImage(_windowBuffer,_windowBufferSize,
+                          currentLine(),endLine);
+        _lineProperties = _screen->getLineProperties(currentLine(),endLine);
+    }
+    else
+    {
+        _lineProperties.clear();
+    }
+    fillUnusedArea(usedLines);
+    _lineProperties.resize(windowLines());
+
+    if (_screen->extendedCharTable()->collections() != _extendedChars.collections())
+        _extendedCharsReused = true;
+    _extendedChars = *_screen->extendedCharTable();
+}
+
+bool ScreenWindow::isLineChanged(int line) const
+{
+    return line < 0 || line >= _changedLines.size() || _changedLines.testBit(line);
+}
+
+void ScreenWindow::resetChangedLines()
+{
+    _changedLines.fill(false);
+    _extendedCharsReused = false;
+}
+
+bool ScreenWindow::extendedCharsReused() const
+{
+    return _extendedCharsReused;
+}
+
+void ScreenWindow::fillUnusedArea(int usedLines)
+{
+    int charsToFill = (windowLines() - usedLines) * windowColumns();
 
     Screen::fillWithDefaultChar(_windowBuffer + _windowBufferSize - charsToFill,charsToFill);
 }
@@ -110,40 +286,53 @@ int ScreenWindow::endWindowLine() const
 }
 QVector<LineProperty> ScreenWindow::getLineProperties()
 {
-    QVector<LineProperty> result = _screen->getLineProperties(currentLine(),endWindowLine());
-    
-    if (result.count() != windowLines())
-        result.resize(windowLines());
+    getImage();
 
-    return result;
+    return _lineProperties;
+}
+
+const ExtendedCharTable* ScreenWindow::extendedCharTable() const
+{
+    return &_extendedChars;
 }
 
 QString ScreenWindow::selectedText( bool preserveLineBreaks ) const
 {
+    QMutexLocker locker(_snapshots->screenLock());
     return _screen->selectedText( preserveLineBreaks );
 }
 
 void ScreenWindow::getSelectionStart( int& column , int& line )
 {
+    QMutexLocker locker(_snapshots->screenLock());
     _screen->getSelectionStart(column,line);
     line -= currentLine();
 }
 void ScreenWindow::getSelectionEnd( int& column , int& line )
 {
+    QMutexLocker locker(_snapshots->screenLock());
     _screen->getSelectionEnd(column,line);
     line -= currentLine();
 }
 void ScreenWindow::setSelectionStart( int column , int line , bool columnMode )
 {
-    _screen->setSelectionStart( column , qMin(line + currentLine(),endWindowLine())  , columnMode);
-    
+    {
+        QMutexLocker locker(_snapshots->screenLock());
+        _screen->setSelectionStart( column , qMin(line + currentLine(),endWindowLine())  , columnMode);
+    }
+
+    // the selection is drawn into the image once the emulation has
+    // taken the next snapshot
     _bufferNeedsUpdate = true;
     emit selectionChanged();
 }
 
 void ScreenWindow::setSelectionEnd( int column , int line )
 {
-    _screen->setSelectionEnd( column , qMin(line + currentLine(),endWindowLine()) );
+    {
+        QMutexLocker locker(_snapshots->screenLock());
+        _screen->setSelectionEnd( column , qMin(line + currentLine(),endWindowLine()) );
+    }
 
     _bufferNeedsUpdate = true;
     emit selectionChanged();
@@ -151,12 +340,16 @@ void ScreenWindow::setSelectionEnd( int column , int line )
 
 bool ScreenWindow::isSelected( int column , int line )
 {
+    QMutexLocker locker(_snapshots->screenLock());
     return _screen->isSelected( column , qMin(line + currentLine(),endWindowLine()) );
 }
 
 void ScreenWindow::clearSelection()
 {
-    _screen->clearSelection();
+    {
+        QMutexLocker locker(_snapshots->screenLock());
+        _screen->clearSelection();
+    }
 
     emit selectionChanged();
 }
@@ -173,27 +366,22 @@ int ScreenWindow::windowLines() const
 
 int ScreenWindow::windowColumns() const
 {
-    return _screen->getColumns();
+    return _columns;
 }
 
 int ScreenWindow::lineCount() const
 {
-    return _screen->getHistLines() + _screen->getLines();
+    return _historyLines + _lines;
 }
 
 int ScreenWindow::columnCount() const
 {
-    return _screen->getColumns();
+    return _columns;
 }
 
 QPoint ScreenWindow::cursorPosition() const
 {
-    QPoint position;
-    
-    position.setX( _screen->getCursorX() );
-    position.setY( _screen->getCursorY() );
-
-    return position;
+    return _cursor;
 }
 
 int ScreenWindow::currentLine() const
@@ -257,37 +445,27 @@ void ScreenWindow::resetScrollCount()
 
 QRect ScreenWindow::scrollRegion() const
 {
-    bool equalToScreenSize = windowLines() == _screen->getLines();
+    bool equalToScreenSize = windowLines() == _lines;
 
     if ( atEndOfOutput() && equalToScreenSize )
-        return _screen->lastScrolledRegion();
+        return _lastScrolledRegion;
     else
         return QRect(0,0,windowColumns(),windowLines());
 }
 
 void ScreenWindow::notifyOutputChanged()
 {
-    // move window to the bottom of the screen and update scroll count
-    // if this window is currently tracking the bottom of the screen
-    if ( _trackOutput )
-    {
-        _scrollCount -= _screen->scrolledLines();
-        _currentLine = qMax(0,_screen->getHistLines() - (windowLines()-_screen->getLines()));
-    }
-    else
+    // when the GUI thread falls behind, notifications for several
+    // snapshots are queued up, but only the latest one is looked at
+    const ScreenSnapshot& snapshot = _snapshots->acquire();
+    if (snapshot.frame == _frame)
     {
-        // if the history is not unlimited then it may
-        // have run out of space and dropped the oldest
-        // lines of output - in this case the screen
-        // window's current line number will need to
-        // be adjusted - otherwise the output will scroll
-        _currentLine = qMax(0,_currentLine -
-                            _screen->droppedLines());
-
-        // ensure that the screen window's current position does
-        // not go beyond the bottom of the screen
-        _currentLine = qMin( _currentLine , _screen->getHistLines() );
+        _snapshots->release();
+        return;
     }
+    _frame = snapshot.frame;
+    syncWithSnapshot(snapshot);
+    _snapshots->release();
 
     _bufferNeedsUpdate = true;
 
@@ -29,8 +29,11 @@
 // Own includes
 #include "Character.h"
 class Screen;
+class ScreenSnapshot;
+class ScreenSnapshotBuffer;
 
 // Qt includes
+#include <QBitArray>
 #include <QObject>
 #include <QPoint>
 #include <QRect>
@@ -51,6 +54,11 @@ class Screen;
  * Whenever the output from the underlying screen is changed, the notifyOutputChanged() slot should
  * be called.  This in turn will update the window's position and emit the outputChanged() signal
  * if necessary.
+ *
+ * The screen is modified by the emulation on a thread of its own.  The window reads the
+ * snapshots which the emulation publishes at the end of each frame, so that it does not
+ * have to wait for the emulation while it is parsing output.  Only the history, the selection
+ * and the text of the screen are read from the screen itself, while holding its lock.
  */
 class ScreenWindow : public QObject
 {
@@ -59,7 +67,8 @@ class ScreenWindow : public QObject
 public:
     /**
      * Constructs a new screen window with the given parent.
-     * A screen must be specified by calling setScreen() before calling getImage() or getLineProperties().
+     * A snapshot buffer must be specified by calling setSnapshotBuffer() before calling getImage()
+     * or getLineProperties().
      *
      * You should not call this constructor directly, instead use the Emulation::createWindow() method
      * to create a window on the emulation which you wish to view.  This allows the emulation
@@ -69,8 +78,11 @@ public:
     ScreenWindow(QObject* parent = 0);
     virtual ~ScreenWindow();
 
-    /** Sets the screen which this window looks onto */
-    void setScreen(Screen* screen);
+    /**
+     * Sets the buffer through which the emulation publishes snapshots of the screen
+     * which this window looks onto.
+     */
+    void setSnapshotBuffer(ScreenSnapshotBuffer* buffer);
     /** Returns the screen which this window looks onto */
     Screen* screen() const;
 
@@ -83,12 +95,40 @@ public:
      */
     Character* getImage();
 
+    /**
+     * Returns true if line @p line of the image returned by getImage() may
+     * have changed since the last call to resetChangedLines().
+     *
+     * When the window looks onto the screen image rather than the history,
+     * getImage() only copies the lines which the screen has modified, and
+     * views can use this to skip comparing the other lines with their
+     * previous contents.
+     */
+    bool isLineChanged(int line) const;
+
+    /** Marks all lines of the window image as unchanged, see isLineChanged() */
+    void resetChangedLines();
+
+    /**
+     * Returns true if keys of the extendedCharTable() may stand for other sequences than
+     * they did before the last call to resetChangedLines().  Views which compare the keys
+     * of cells to find the ones which changed must then redraw all extended characters.
+     */
+    bool extendedCharsReused() const;
+
     /**
      * Returns the line attributes associated with the lines of characters which
-     * are currently visible through this window
+     * are currently visible through this window, as returned by getImage()
      */
     QVector<LineProperty> getLineProperties();
 
+    /**
+     * Returns the table in which the sequences of characters of cells in
+     * the image with the RE_EXTENDED_CHAR rendition flag are stored.  The
+     * table is a copy which is updated by getImage() along with the image.
+     */
+    const ExtendedCharTable* extendedCharTable() const;
+
     /**
      * Returns the number of lines which the region of the window
      * specified by scrollRegion() has been scrolled by since the last call
@@ -243,12 +283,39 @@ signals:
 
 private:
     int endWindowLine() const;
-    void fillUnusedArea();
+    void fillUnusedArea(int usedLines);
+    void syncWithSnapshot(const ScreenSnapshot& snapshot);
+    void copyFromSnapshot(const ScreenSnapshot& snapshot, int firstScreenLine);
+    void copyFromScreen();
 
+    ScreenSnapshotBuffer* _snapshots;
+    quint64 _frame;     // the snapshot which notifyOutputChanged() last saw
+
+    // state of the screen in the snapshot which the window last looked at
     Screen* _screen;
+    int _lines;
+    int _columns;
+    int _historyLines;
+    QPoint _cursor;
+    QRect _lastScrolledRegion;
+    qint64 _scrolledLines;
+    qint64 _droppedLines;
+
     Character* _windowBuffer;
     int _windowBufferSize;
     bool _bufferNeedsUpdate;
+    bool _bufferNeedsFullUpdate;
+    QVector<LineProperty> _lineProperties;
+    ExtendedCharTable _extendedChars;
+
+    // state of the snapshot when _windowBuffer was last updated from it,
+    // used to copy only the lines which have changed since then.
+    // _firstScreenLine is -1 when the buffer was read from the screen
+    quint64 _changeSerial;
+    int _firstScreenLine;
+    int _cursorLine;
+    QBitArray _changedLines;
+    bool _extendedCharsReused;
 
     int  _windowLines;
     int  _currentLine;
@@ -24,6 +24,7 @@
 ****************************************************************************/
 
 #include "Shell.h"
+#include "ByteQueue.h"
 
 #include <QSsh>
 
@@ -36,9 +37,13 @@
 
 using namespace QSsh;
 
+// largest amount of output read from the channel at a time
+static const int ReadChunkSize = 64 * 1024;
+
 Shell::Shell(const SshConnectionParameters &parameters, QObject *parent)
     : QObject(parent),
-      m_connection(new SshConnection(parameters))
+      m_connection(new SshConnection(parameters, this)),
+      m_outputQueue(0)
 {
     connect(m_connection, SIGNAL(connected()), SLOT(handleConnected()));
     connect(m_connection, SIGNAL(dataAvailable(QString)), SLOT(handleShellMessage(QString)));
@@ -55,6 +60,15 @@ void Shell::run()
     m_connection->connectToHost();
 }
 
+void Shell::setOutputQueue(ByteQueue *queue)
+{
+    if (m_outputQueue)
+        disconnect(m_outputQueue, 0, this, 0);
+    m_outputQueue = queue;
+    if (m_outputQueue)
+        connect(m_outputQueue, SIGNAL(spaceAvailable()), SLOT(queueRemoteOutput()), Qt::QueuedConnection);
+}
+
 bool Shell::isShellStarted(){
     if(m_shell){
         return m_shell->isRunning();
@@ -65,7 +79,7 @@ bool Shell::isShellStarted(){
 void Shell::handleConnectionError()
 {
     std::cerr << "SSH connection error: " << qPrintable(m_connection->errorString()) << std::endl;
-    qApp->exit(EXIT_FAILURE);
+    emit finished(EXIT_FAILURE);
 }
 
 void Shell::handleShellMessage(const QString &message)
@@ -85,19 +99,49 @@ void Shell::handleConnected()
 
 void Shell::handleRemoteStdout()
 {
-    emit remoteStdout(m_shell->readAllStandardOutput());
+    if (!m_outputQueue) {
+        emit remoteStdout(m_shell->readAllStandardOutput());
+        return;
+    }
+    queueRemoteOutput();
 }
 
 void Shell::handleRemoteStderr()
 {
-    emit remoteStdout(m_shell->readAllStandardError());
+    if (!m_outputQueue) {
+        emit remoteStdout(m_shell->readAllStandardError());
+        return;
+    }
+    m_pendingOutput.append(m_shell->readAllStandardError());
+    queueRemoteOutput();
+}
+
+void Shell::queueRemoteOutput()
+{
+    if (!m_shell)
+        return;
+
+    forever {
+        if (!m_pendingOutput.isEmpty()) {
+            const int written = m_outputQueue->write(m_pendingOutput.constData(), m_pendingOutput.size());
+            m_pendingOutput.remove(0, written);
+
+            // the queue is full, carry on when the emulation has made room
+            if (!m_pendingOutput.isEmpty())
+                return;
+        }
+
+        if (m_shell->bytesAvailable() <= 0)
+            return;
+        m_pendingOutput = m_shell->read(qBound(1, m_outputQueue->freeSpace(), ReadChunkSize));
+    }
 }
 
 void Shell::handleChannelClosed(int exitStatus)
 {
     std::cerr << "Shell closed. Exit status was " << exitStatus << ", exit code was "
         << m_shell->exitCode() << "." << std::endl;
-    qApp->exit(exitStatus == SshRemoteProcess::NormalExit && m_shell->exitCode() == 0
+    emit finished(exitStatus == SshRemoteProcess::NormalExit && m_shell->exitCode() == 0
         ? EXIT_SUCCESS : EXIT_FAILURE);
 }
 
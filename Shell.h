@@ -35,12 +35,22 @@ class SshConnectionParameters;
 class SshRemoteProcess;
 }
 
+class ByteQueue;
+
 QT_BEGIN_NAMESPACE
 class QByteArray;
 class QFile;
 class QString;
 QT_END_NAMESPACE
 
+/*
+ * Runs a remote shell over an SSH connection.
+ *
+ * The shell can be moved to a thread of its own, so that the connection is
+ * serviced while the GUI thread is busy.  Its output is then handed over
+ * through a ByteQueue set with setOutputQueue(), and input is passed to
+ * writeRemote() through a queued connection.
+ */
 class Shell : public QObject
 {
     Q_OBJECT
@@ -48,12 +58,20 @@ public:
     Shell(const QSsh::SshConnectionParameters &parameters, QObject *parent = 0);
     ~Shell();
 
-    void run();
     bool isShellStarted();
+
+    // Sets the queue which the output of the shell is written to.  While the
+    // queue is full the output is left in the channel.  Without a queue the
+    // output is emitted with remoteStdout().
+    void setOutputQueue(ByteQueue *queue);
 signals:
     void remoteStdout(QByteArray data);
     void shellStarted();
+    // Emitted when the connection or the shell ended, with the exit code
+    // for the application
+    void finished(int exitCode);
 public slots:
+    void run();
     void writeRemote(QByteArray data);
 
 private slots:
@@ -63,10 +81,13 @@ private slots:
     void handleRemoteStderr();
     void handleShellMessage(const QString &message);
     void handleChannelClosed(int exitStatus);
+    void queueRemoteOutput();
 
 private:
     QSsh::SshConnection *m_connection;
     QSharedPointer<QSsh::SshRemoteProcess> m_shell;
+    ByteQueue *m_outputQueue;
+    QByteArray m_pendingOutput; // output read from the channel which did not fit into the queue
 };
 
 #endif // SHELL_H
@@ -33,6 +33,54 @@
 // Qt includes
 #include <QTextStream>
 
+// appends the unicode character 'c' to 'text', as a surrogate pair if it
+// lies outside of the basic multilingual plane
+static inline void appendCharacter(QString& text, uint c)
+{
+    if (QChar::requiresSurrogates(c))
+    {
+        text.append(QChar(QChar::highSurrogate(c)));
+        text.append(QChar(QChar::lowSurrogate(c)));
+    }
+    else
+        text.append(QChar(c));
+}
+
+// appends the text of 'character' to 'text', looking up sequences of
+// characters in 'extendedChars'
+static inline void appendCharacter(QString& text, const Character& character,
+                                   const ExtendedCharTable* extendedChars)
+{
+    if (!(character.rendition & RE_EXTENDED_CHAR))
+    {
+        appendCharacter(text, character.character);
+        return;
+    }
+
+    int length = 0;
+    const uint* chars = extendedChars ? extendedChars->lookupExtendedChar(character.character, length) : 0;
+    if (!chars)
+    {
+        appendCharacter(text, 0xfffd);
+        return;
+    }
+    for (int i = 0; i < length; i++)
+        appendCharacter(text, chars[i]);
+}
+
+// returns the number of columns taken by 'character'.  for a sequence
+// this is the width of its first character, the others are combined with it
+static inline int characterWidth(const Character& character,
+                                 const ExtendedCharTable* extendedChars)
+{
+    if (!(character.rendition & RE_EXTENDED_CHAR))
+        return konsole_wcwidth(character.character);
+
+    int length = 0;
+    const uint* chars = extendedChars ? extendedChars->lookupExtendedChar(character.character, length) : 0;
+    return (chars && length > 0) ? konsole_wcwidth(chars[0]) : 1;
+}
+
 PlainTextDecoder::PlainTextDecoder()
     : _output(0)
     , _includeTrailingWhitespace(true)
@@ -103,8 +151,8 @@ void PlainTextDecoder::decodeLine(const Character* const characters, int count,
     
     for (int i=0;i<outputCount;)
     {
-        plainText.append( QChar(characters[i].character) );
-        i += qMax(1,konsole_wcwidth(characters[i].character));
+        appendCharacter( plainText, characters[i], _extendedChars );
+        i += qMax(1,characterWidth(characters[i], _extendedChars));
     }
     *_output << plainText;
 }
@@ -156,7 +204,8 @@ void HTMLDecoder::decodeLine(const Character* const characters, int count, LineP
 
     for (int i=0;i<count;i++)
     {
-        QChar ch(characters[i].character);
+        // sequences of characters are never whitespace or markup
+        const uint ch = (characters[i].rendition & RE_EXTENDED_CHAR) ? 0 : characters[i].character;
 
         //check if appearance of character is different from previous char
         if ( characters[i].rendition != _lastRendition  ||
@@ -203,7 +252,7 @@ void HTMLDecoder::decodeLine(const Character* const characters, int count, LineP
         }
 
         //handle whitespace
-        if (ch.isSpace())
+        if (QChar::isSpace(ch))
             spaceCount++;
         else
             spaceCount = 0;
@@ -218,7 +267,7 @@ void HTMLDecoder::decodeLine(const Character* const characters, int count, LineP
             else if (ch == '>')
                 text.append("&gt;");
             else
-                text.append(ch);
+                appendCharacter(text, characters[i], _extendedChars);
         }
         else
         {
@@ -47,8 +47,16 @@ class QTextStream;
 class TerminalCharacterDecoder
 {
 public:
+    TerminalCharacterDecoder() : _extendedChars(0) {}
     virtual ~TerminalCharacterDecoder() {}
 
+    /**
+     * Sets the table used to look up the sequences of characters in cells
+     * with the RE_EXTENDED_CHAR rendition flag.  Without a table such cells
+     * are decoded as U+FFFD.
+     */
+    void setExtendedCharTable(const ExtendedCharTable* table) { _extendedChars = table; }
+
     /** Begin decoding characters.  The resulting text is appended to @p output. */
     virtual void begin(QTextStream* output) = 0;
     /** End decoding. */
@@ -65,6 +73,9 @@ public:
     virtual void decodeLine(const Character* const characters,
                             int count,
                             LineProperty properties) = 0;
+
+protected:
+    const ExtendedCharTable* _extendedChars;
 };
 
 /**
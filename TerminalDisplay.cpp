@@ -30,6 +30,7 @@
 // Own includes
 #include "TerminalDisplay.h"
 #include "Filter.h"
+#include "GlyphAtlas.h"
 #include "konsole_wcwidth.h"
 #include "ScreenWindow.h"
 #include "TerminalCharacterDecoder.h"
@@ -56,6 +57,10 @@
 #include <QMimeData>
 #include <QDrag>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 
 // WARNING: Autogenerated by "fontembedder ./linefont.src".
 // You probably do not want to hand-edit this!
@@ -119,6 +124,10 @@ bool TerminalDisplay::HAVE_TRANSPARENCY = true;
 // more information can be found in: http://unicode.org/reports/tr9/ 
 const QChar LTR_OVERRIDE_CHAR( 0x202D );
 
+// maximum number of text fragments kept in the static text cache,
+// enough for a few screens full of differently colored text
+#define STATIC_TEXT_CACHE_SIZE 4096
+
 /* ------------------------------------------------------------------------- */
 /*                                                                           */
 /*                                Colors                                     */
@@ -146,6 +155,7 @@ void TerminalDisplay::setScreenWindow(ScreenWindow* window)
     }
 
     _screenWindow = window;
+    _compareAllLines = true;
 
     if ( window )
     {
@@ -174,13 +184,13 @@ void TerminalDisplay::setBackgroundColor(const QColor& color)
     // Avoid propagating the palette change to the scroll bar
     _scrollBar->setPalette( QApplication::palette() );
 
-    update();
+    updateContents();
 }
 void TerminalDisplay::setForegroundColor(const QColor& color)
 {
     _colorTable[DEFAULT_FORE_COLOR].color = color;
 
-    update();
+    updateContents();
 }
 void TerminalDisplay::setColorTable(const ColorEntry table[])
 {
@@ -208,12 +218,36 @@ void TerminalDisplay::setColorTable(const ColorEntry table[])
    QCodec.
 */
 
-static inline bool isLineChar(quint16 c) { return ((c & 0xFF80) == 0x2500);}
+static inline bool isLineChar(uint c) { return ((c & ~0x7Fu) == 0x2500);}
 static inline bool isLineCharString(QString string)
 {
     return (string.length() > 0) && (isLineChar(string.at(0).unicode()));
 }
 
+// appends the unicode character 'c' to 'buffer' at position 'p', as a
+// surrogate pair if it lies outside of the basic multilingual plane
+static inline void appendCharacter(QChar* buffer, int& p, uint c)
+{
+    if (QChar::requiresSurrogates(c))
+    {
+        buffer[p++] = QChar(QChar::highSurrogate(c));
+        buffer[p++] = QChar(QChar::lowSurrogate(c));
+    }
+    else
+        buffer[p++] = QChar(c);
+}
+
+// appends the sequence of characters referenced by 'key' in 'extendedChars'
+// to 'buffer' at position 'p'
+static inline void appendExtendedChar(QChar* buffer, int& p, uint key,
+                                      const ExtendedCharTable* extendedChars)
+{
+    int length = 0;
+    const uint* chars = extendedChars ? extendedChars->lookupExtendedChar(key, length) : 0;
+    for (int i = 0; i < length; i++)
+        appendCharacter(buffer, p, chars[i]);
+}
+
 
 // assert for i in [0..31] : vt100extended(vt100_graphics[i]) == i.
 
@@ -253,9 +287,12 @@ void TerminalDisplay::fontChange(const QFont&)
 
     _fontAscent = fm.ascent();
 
+    _staticTextCache.clear();
+    updateGlyphAtlas();
+
     emit changedFontMetricSignal( _fontHeight, _fontWidth );
     propagateSize();
-    update();
+    updateContents();
 }
 
 void TerminalDisplay::setVTFont(const QFont& f)
@@ -297,7 +334,11 @@ int TerminalDisplay::textWidth(int startColumn, int length, int line) const {
     QFontMetrics fm(font());
     int result = 0;
     for (int column = 0; column < length; column++) {
-        result += fm.width(_image[loc(startColumn + column, line)].character);
+        const uint c = _image[loc(startColumn + column, line)].character;
+        if (QChar::requiresSurrogates(c))
+            result += fm.width(QString::fromUcs4(&c, 1));
+        else
+            result += fm.width(QChar(c));
     }
     return result;
 }
@@ -339,6 +380,7 @@ TerminalDisplay::TerminalDisplay(QWidget *parent)
     ,_contentHeight(1)
     ,_contentWidth(1)
     ,_image(0)
+    ,_compareAllLines(true)
     ,_randomSeed(0)
     ,_resizing(false)
     ,_terminalSizeHint(false)
@@ -369,6 +411,7 @@ TerminalDisplay::TerminalDisplay(QWidget *parent)
     ,_colorsInverted(false)
     ,_blendColor(qRgba(0,0,0,0xff))
     ,_filterChain(new TerminalImageFilterChain())
+    ,_mouseOverHotspot(0)
     ,_cursorShape(BlockCursor)
     ,mMotionAfterPasting(NoMoveScreenWindow)
 {
@@ -384,6 +427,10 @@ TerminalDisplay::TerminalDisplay(QWidget *parent)
 
     // create scroll bar for scrolling output up and down
     // set the scroll bar's slider to occupy the whole area of the scroll bar initially
+    _staticTextCache.setMaxCost(STATIC_TEXT_CACHE_SIZE);
+    _textRenderingMode = PainterRendering;
+    _glyphAtlas = 0;
+
     _scrollBar = new QScrollBar(this);
     setScroll(0,0);
     _scrollBar->setCursor( Qt::ArrowCursor );
@@ -398,6 +445,9 @@ TerminalDisplay::TerminalDisplay(QWidget *parent)
     connect(_blinkTimer, SIGNAL(timeout()), this, SLOT(blinkEvent()));
     _blinkCursorTimer   = new QTimer(this);
     connect(_blinkCursorTimer, SIGNAL(timeout()), this, SLOT(blinkCursorEvent()));
+    _filterTimer = new QTimer(this);
+    _filterTimer->setSingleShot(true);
+    connect(_filterTimer, SIGNAL(timeout()), this, SLOT(updateFilters()));
 
     //  KCursor::setAutoHideCursor( this, true );
 
@@ -437,6 +487,7 @@ TerminalDisplay::~TerminalDisplay()
     delete _gridLayout;
     delete _outputSuspendedLabel;
     delete _filterChain;
+    delete _glyphAtlas;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -622,6 +673,9 @@ void TerminalDisplay::setOpacity(qreal opacity)
     }*/
 
     _blendColor = color.rgba();
+
+    // the new opacity applies from the next repaint on
+    _backingStoreDirty = rect();
 }
 
 void TerminalDisplay::drawBackground(QPainter& painter, const QRect& rect, const QColor& backgroundColor, bool useOpacitySetting )
@@ -757,8 +811,15 @@ void TerminalDisplay::drawCharacters(QPainter& painter,
         // the widget-specific layout direction, which should always be
         // Qt::LeftToRight for this widget
         // This was discussed in: http://lists.kde.org/?t=120552223600002&r=1&w=2
+        const bool untransformed = painter.worldTransform().type() == QTransform::TxNone;
+
         if (_bidiEnabled)
             painter.drawText(rect,0,text);
+        else if (_glyphAtlas && untransformed &&
+                 _glyphAtlas->drawText(painter,rect.topLeft(),text,color,useBold,useUnderline))
+            ;
+        else if (untransformed)
+            drawStaticText(painter,rect,text);
         else
 #if QT_VERSION >= 0x040800
             painter.drawText(rect, Qt::AlignBottom, LTR_OVERRIDE_CHAR + text);
@@ -768,32 +829,89 @@ void TerminalDisplay::drawCharacters(QPainter& painter,
     }
 }
 
+void TerminalDisplay::drawStaticText(QPainter& painter, const QRect& rect, const QString& text)
+{
+    const QFont& font = painter.font();
+
+    const QString key = QChar((font.bold() ? 1 : 0) | (font.underline() ? 2 : 0)) + text;
+
+    QStaticText* staticText = _staticTextCache.object(key);
+    if (!staticText)
+    {
+        staticText = new QStaticText(LTR_OVERRIDE_CHAR + text);
+        staticText->setTextFormat(Qt::PlainText);
+        staticText->setPerformanceHint(QStaticText::AggressiveCaching);
+        staticText->prepare(QTransform(), font);
+        _staticTextCache.insert(key, staticText);
+    }
+
+    // align the text to the bottom of 'rect', as drawCharacters() does
+    // when drawing text directly
+    painter.drawStaticText(rect.left(), rect.top() + _lineSpacing, *staticText);
+}
+
+void TerminalDisplay::setTextRenderingMode(TextRenderingMode mode)
+{
+    if (mode == _textRenderingMode)
+        return;
+
+    _textRenderingMode = mode;
+    updateGlyphAtlas();
+
+    updateContents();
+}
+
+void TerminalDisplay::updateGlyphAtlas()
+{
+    delete _glyphAtlas;
+    _glyphAtlas = 0;
+
+    // the atlas can only draw text on a grid of equally sized cells,
+    // variable-width fonts are always drawn by QPainter
+    if (_textRenderingMode == GlyphAtlasRendering && _fixedFont)
+    {
+        _glyphAtlas = new GlyphAtlas();
+        _glyphAtlas->setFont(font(), _fontWidth, _fontHeight, _lineSpacing + _fontAscent);
+    }
+}
+
+void TerminalDisplay::drawLineBackground(QPainter& painter, int topLeftX, int topLeftY,
+                                         int startColumn, int endColumn, int line)
+{
+    const QColor defaultBackground = palette().background().color();
+
+    int x = startColumn;
+    while (x <= endColumn)
+    {
+        const CharacterColor& background = _image[loc(x,line)].backgroundColor;
+
+        int len = 1;
+        while (x+len <= endColumn && _image[loc(x+len,line)].backgroundColor == background)
+            len++;
+
+        const QColor color = background.color(_colorTable);
+        if ( color != defaultBackground )
+            drawBackground(painter,calculateTextArea(topLeftX,topLeftY,x,line,len),color,
+                           false /* do not use transparency */);
+
+        x += len;
+    }
+}
+
 void TerminalDisplay::drawTextFragment(QPainter& painter , 
                                        const QRect& rect,
                                        QString text,
                                        const Character* style)
 {
-    painter.save();
-
-    // setup painter
-    const QColor foregroundColor = style->foregroundColor.color(_colorTable);
-    const QColor backgroundColor = style->backgroundColor.color(_colorTable);
-    
-    // draw background if different from the display's background color
-    if ( backgroundColor != palette().background().color() )
-        drawBackground(painter,rect,backgroundColor,
-                       false /* do not use transparency */);
-
     // draw cursor shape if the current character is the cursor
     // this may alter the foreground and background colors
     bool invertCharacterColor = false;
     if ( style->rendition & RE_CURSOR )
-        drawCursor(painter,rect,foregroundColor,backgroundColor,invertCharacterColor);
+        drawCursor(painter,rect,style->foregroundColor.color(_colorTable),
+                   style->backgroundColor.color(_colorTable),invertCharacterColor);
 
     // draw text
     drawCharacters(painter,rect,text,style,invertCharacterColor);
-
-    painter.restore();
 }
 
 void TerminalDisplay::setRandomSeed(uint randomSeed) { _randomSeed = randomSeed; }
@@ -920,41 +1038,41 @@ void TerminalDisplay::scrollImage(int lines , const QRect& screenWindowRegion)
     Q_ASSERT(scrollRect.isValid() && !scrollRect.isEmpty());
 
     //scroll the display vertically to match internal _image
-    scroll( 0 , _fontHeight * (-lines) , scrollRect );
+    scrollBackingStore( _fontHeight * (-lines) , scrollRect );
 }
 
 QRegion TerminalDisplay::hotSpotRegion() const 
 {
-    QRegion region;
-    foreach( Filter::HotSpot* hotSpot , _filterChain->hotSpots() )
+    // the spans of the hotspots are ordered by line and column and do not
+    // overlap, which is the order QRegion keeps its rectangles in
+    const QVector<FilterChain::HotSpotSpan>& spans = _filterChain->hotSpotSpans();
+    QVector<QRect> rects;
+    rects.reserve(spans.count());
+
+    QRect last;
+    foreach( const FilterChain::HotSpotSpan& span , spans )
     {
         QRect r;
-        if (hotSpot->startLine()==hotSpot->endLine()) {
-            r.setLeft(hotSpot->startColumn());
-            r.setTop(hotSpot->startLine());
-            r.setRight(hotSpot->endColumn());
-            r.setBottom(hotSpot->endLine());
-            region |= imageToWidget(r);;
+        r.setLeft(span.startColumn);
+        r.setTop(span.line);
+        r.setRight(qMin(span.endColumn,_columns));
+        r.setBottom(span.line);
+        if (r.left() > r.right())
+            continue;
+
+        // spans which touch are joined into one rectangle
+        if (!rects.isEmpty() && last.top() == r.top() && last.right() + 1 >= r.left()) {
+            last.setRight(r.right());
+            rects.last() = imageToWidget(last);
         } else {
-            r.setLeft(hotSpot->startColumn());
-            r.setTop(hotSpot->startLine());
-            r.setRight(_columns);
-            r.setBottom(hotSpot->startLine());
-            region |= imageToWidget(r);;
-            for ( int line = hotSpot->startLine()+1 ; line < hotSpot->endLine() ; line++ ) {
-                r.setLeft(0);
-                r.setTop(line);
-                r.setRight(_columns);
-                r.setBottom(line);
-                region |= imageToWidget(r);;
-            }
-            r.setLeft(0);
-            r.setTop(hotSpot->endLine());
-            r.setRight(hotSpot->endColumn());
-            r.setBottom(hotSpot->endLine());
-            region |= imageToWidget(r);;
+            last = r;
+            rects << imageToWidget(r);
         }
     }
+
+    QRegion region;
+    if (!rects.isEmpty())
+        region.setRects(rects.constData(),rects.count());
     return region;
 }
 
@@ -970,17 +1088,78 @@ void TerminalDisplay::processFilters()
     // ScreenWindow emits a scrolled() signal - which will happen before
     // updateImage() is called on the display and therefore _image is
     // out of date at this point
+    _filterChain->setExtendedCharTable( _screenWindow->extendedCharTable() );
     _filterChain->setImage( _screenWindow->getImage(),
                             _screenWindow->windowLines(),
                             _screenWindow->windowColumns(),
                             _screenWindow->getLineProperties() );
     _filterChain->process();
 
+    // the hotspot under the mouse may have been deleted
+    _mouseOverHotspot = 0;
+
+    // scan the rest of the image a frame later, unless new output
+    // triggers another pass before then
+    if (_filterChain->hasPendingBlocks())
+        _filterTimer->start(FILTER_CONTINUE_DELAY);
+    else
+        _filterTimer->stop();
+
     QRegion postUpdateHotSpots = hotSpotRegion();
 
     update( preUpdateHotSpots | postUpdateHotSpots );
 }
 
+// compares 'count' cells of 'a' and 'b', sets the entries of 'dirtyMask' to
+// true for the cells which differ and to false for the others, and returns
+// the number of cells which differ
+static int compareCells(const Character* a, const Character* b, int count, char* dirtyMask)
+{
+    int x = 0;
+    int dirtyCount = 0;
+
+#ifdef __SSE2__
+    // four cells are compared as three 16 byte blocks
+    static_assert(sizeof(Character) == 12, "compareCells() expects 12 byte characters");
+    const quint64 allEqual = Q_UINT64_C(0xffffffffffff);
+
+    for (; x + 4 <= count; x += 4)
+    {
+        const __m128i* blockA = reinterpret_cast<const __m128i*>(a + x);
+        const __m128i* blockB = reinterpret_cast<const __m128i*>(b + x);
+
+        const quint64 equal = quint64(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(blockA),
+                                                                        _mm_loadu_si128(blockB))))
+                | quint64(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(blockA + 1),
+                                                           _mm_loadu_si128(blockB + 1)))) << 16
+                | quint64(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(blockA + 2),
+                                                           _mm_loadu_si128(blockB + 2)))) << 32;
+
+        if (equal == allEqual)
+        {
+            memset(dirtyMask + x, 0, 4);
+            continue;
+        }
+
+        for (int i = 0; i < 4; i++)
+        {
+            const bool dirty = ((equal >> (12 * i)) & 0xfff) != 0xfff;
+            dirtyMask[x + i] = dirty;
+            dirtyCount += dirty;
+        }
+    }
+#endif
+
+    for (; x < count; x++)
+    {
+        const bool dirty = a[x] != b[x];
+        dirtyMask[x] = dirty;
+        dirtyCount += dirty;
+    }
+
+    return dirtyCount;
+}
+
 void TerminalDisplay::updateImage() 
 {
     if ( !_screenWindow )
@@ -1008,24 +1187,32 @@ void TerminalDisplay::updateImage()
     Q_ASSERT( this->_usedLines <= this->_lines );
     Q_ASSERT( this->_usedColumns <= this->_columns );
 
-    int y,x,len;
+    int y,x;
 
     QPoint tL  = contentsRect().topLeft();
     int    tLx = tL.x();
     int    tLy = tL.y();
     _hasBlinker = false;
 
-    CharacterColor cf;       // undefined
-    CharacterColor _clipboard;       // undefined
-    int cr  = -1;   // undefined
-
     const int linesToUpdate = qMin(this->_lines, qMax(0,lines  ));
     const int columnsToUpdate = qMin(this->_columns,qMax(0,columns));
 
-    QChar *disstrU = new QChar[columnsToUpdate];
-    char *dirtyMask = new char[columnsToUpdate+2];
+    _dirtyMask.resize(columnsToUpdate);
+    char* const dirtyMask = _dirtyMask.data();
     QRegion dirtyRegion;
 
+    if (_blinkingLines.size() != linesToUpdate)
+    {
+        _blinkingLines.fill(false,linesToUpdate);
+        _compareAllLines = true;
+    }
+
+    // the keys of extended characters may have been handed to other
+    // sequences, so a cell with the same key as before may need redrawing
+    const bool extendedCharsReused = _screenWindow->extendedCharsReused();
+    if (extendedCharsReused)
+        _compareAllLines = true;
+
     // debugging variable, this records the number of lines that are found to
     // be 'dirty' ( ie. have changed from the old _image to the new _image ) and
     // which therefore need to be repainted
@@ -1036,84 +1223,65 @@ void TerminalDisplay::updateImage()
         const Character*       currentLine = &_image[y*this->_columns];
         const Character* const newLine = &newimg[y*columns];
 
-        bool updateLine = false;
+        //both the top and bottom halves of double height _lines must always be redrawn
+        //although both top and bottom halves contain the same characters, only
+        //the top one is actually
+        //drawn.
+        const bool doubleHeight = _lineProperties.count() > y &&
+                                  (_lineProperties[y] & LINE_DOUBLEHEIGHT);
+
+        // lines which the screen window has not changed since the last
+        // update still match the new image
+        if (!_compareAllLines && !doubleHeight && !_screenWindow->isLineChanged(y))
+        {
+            if (!_resizing)
+                _hasBlinker |= _blinkingLines.testBit(y);
+            continue;
+        }
 
-        // The dirty mask indicates which characters need repainting. We also
-        // mark surrounding neighbours dirty, in case the character exceeds
-        // its cell boundaries
-        memset(dirtyMask, 0, columnsToUpdate+2);
+        bool updateLine = false;
 
-        for( x = 0 ; x < columnsToUpdate ; ++x)
+        // The dirty mask indicates which characters need repainting
+        int dirtyCount = compareCells(currentLine,newLine,columnsToUpdate,dirtyMask);
+        if (extendedCharsReused)
         {
-            if ( newLine[x] != currentLine[x] )
+            for (x = 0; x < columnsToUpdate; ++x)
             {
-                dirtyMask[x] = true;
+                if (!dirtyMask[x] && (newLine[x].rendition & RE_EXTENDED_CHAR))
+                {
+                    dirtyMask[x] = true;
+                    dirtyCount++;
+                }
             }
         }
 
-        if (!_resizing) // not while _resizing, we're expecting a paintEvent
+        // the blinking text on a line can only change along with the line
+        if (dirtyCount > 0 || _compareAllLines)
+        {
+            bool lineHasBlinker = false;
             for (x = 0; x < columnsToUpdate; ++x)
-            {
-                _hasBlinker |= (newLine[x].rendition & RE_BLINK);
+                lineHasBlinker |= (newLine[x].rendition & RE_BLINK);
+            _blinkingLines.setBit(y,lineHasBlinker);
+        }
 
-                // Start drawing if this character or the next one differs.
-                // We also take the next one into account to handle the situation
-                // where characters exceed their cell width.
-                if (dirtyMask[x])
-                {
-                    quint16 c = newLine[x+0].character;
-                    if ( !c )
-                        continue;
-                    int p = 0;
-                    disstrU[p++] = c; //fontMap(c);
-                    bool lineDraw = isLineChar(c);
-                    bool doubleWidth = (x+1 == columnsToUpdate) ? false : (newLine[x+1].character == 0);
-                    cr = newLine[x].rendition;
-                    _clipboard = newLine[x].backgroundColor;
-                    if (newLine[x].foregroundColor != cf) cf = newLine[x].foregroundColor;
-                    int lln = columnsToUpdate - x;
-                    for (len = 1; len < lln; ++len)
-                    {
-                        const Character& ch = newLine[x+len];
-
-                        if (!ch.character)
-                            continue; // Skip trailing part of multi-col chars.
-
-                        bool nextIsDoubleWidth = (x+len+1 == columnsToUpdate) ? false : (newLine[x+len+1].character == 0);
-
-                        if (  ch.foregroundColor != cf ||
-                              ch.backgroundColor != _clipboard ||
-                              ch.rendition != cr ||
-                              !dirtyMask[x+len] ||
-                              isLineChar(c) != lineDraw ||
-                              nextIsDoubleWidth != doubleWidth )
-                            break;
-
-                        disstrU[p++] = c; //fontMap(c);
-                    }
-
-                    QString unistr(disstrU, p);
-
-                    bool saveFixedFont = _fixedFont;
-                    if (lineDraw)
-                        _fixedFont = false;
-                    if (doubleWidth)
-                        _fixedFont = false;
+        if (!_resizing) // not while _resizing, we're expecting a paintEvent
+        {
+            _hasBlinker |= _blinkingLines.testBit(y);
 
+            // the line needs repainting if a character has changed, the
+            // trailing parts of multi-column characters are drawn along
+            // with the first part
+            for (x = 0; x < columnsToUpdate && dirtyCount > 0; ++x)
+            {
+                if (dirtyMask[x] && newLine[x].character)
+                {
                     updateLine = true;
-
-                    _fixedFont = saveFixedFont;
-                    x += len - 1;
+                    break;
                 }
-
             }
+        }
 
-        //both the top and bottom halves of double height _lines must always be redrawn
-        //although both top and bottom halves contain the same characters, only
-        //the top one is actually
-        //drawn.
-        if (_lineProperties.count() > y)
-            updateLine |= (_lineProperties[y] & LINE_DOUBLEHEIGHT);
+        updateLine |= doubleHeight;
 
         // if the characters on the line are different in the old and the new _image
         // then this line must be repainted.
@@ -1133,7 +1301,8 @@ void TerminalDisplay::updateImage()
 
         // replace the line of characters in the old _image with the
         // current line of the new _image
-        memcpy((void*)currentLine,(const void*)newLine,columnsToUpdate*sizeof(Character));
+        if (dirtyCount > 0)
+            memcpy((void*)currentLine,(const void*)newLine,columnsToUpdate*sizeof(Character));
     }
 
     // if the new _image is smaller than the previous _image, then ensure that the area
@@ -1156,16 +1325,16 @@ void TerminalDisplay::updateImage()
     }
     _usedColumns = columnsToUpdate;
 
+    _screenWindow->resetChangedLines();
+    _compareAllLines = false;
+
     dirtyRegion |= _inputMethodData.previousPreeditRect;
 
     // update the parts of the display which have changed
-    update(dirtyRegion);
+    updateContents(dirtyRegion);
 
     if ( _hasBlinker && !_blinkTimer->isActive()) _blinkTimer->start( TEXT_BLINK_DELAY );
     if (!_hasBlinker && _blinkTimer->isActive()) { _blinkTimer->stop(); _blinking = false; }
-    delete[] dirtyMask;
-    delete[] disstrU;
-
 }
 
 void TerminalDisplay::showResizeNotification()
@@ -1225,7 +1394,11 @@ void TerminalDisplay::setBlinkingTextEnabled(bool blink)
     if (!blink && _blinkTimer->isActive())
     {
         _blinkTimer->stop();
-        _blinking = false;
+        if (_blinking)
+        {
+            _blinking = false;
+            updateBlinkingText();
+        }
     }
 }
 
@@ -1259,16 +1432,100 @@ void TerminalDisplay::focusInEvent(QFocusEvent*)
 
 void TerminalDisplay::paintEvent( QPaintEvent* pe )
 {
+    const QRegion region = pe->region() & contentsRect();
+
+    renderBackingStore(region);
+
     QPainter paint(this);
 
-    foreach (const QRect &rect, (pe->region() & contentsRect()).rects())
+    // copy the backing store including its alpha channel, as
+    // drawBackground() does with a translucent background
+    const qreal ratio = _backingStore.devicePixelRatio();
+    paint.setCompositionMode(QPainter::CompositionMode_Source);
+    foreach (const QRect &rect, region.rects())
+    {
+        paint.drawPixmap(rect, _backingStore,
+                         QRectF(rect.x() * ratio, rect.y() * ratio,
+                                rect.width() * ratio, rect.height() * ratio));
+    }
+    paint.setCompositionMode(QPainter::CompositionMode_SourceOver);
+
+    drawInputMethodPreeditString(paint,preeditRect());
+    paintFilters(paint);
+}
+
+void TerminalDisplay::updateContents(const QRegion& region)
+{
+    _backingStoreDirty |= region;
+    update(region);
+}
+
+void TerminalDisplay::updateContents()
+{
+    updateContents(rect());
+}
+
+void TerminalDisplay::renderBackingStore(const QRegion& region)
+{
+    const qreal ratio = devicePixelRatioF();
+    const QSize size = this->size() * ratio;
+
+    if (_backingStore.size() != size || _backingStore.devicePixelRatio() != ratio)
+    {
+        _backingStore = QPixmap(size);
+        _backingStore.setDevicePixelRatio(ratio);
+        // filling with a transparent color gives the pixmap an alpha channel,
+        // needed for translucent backgrounds
+        _backingStore.fill(Qt::transparent);
+        _backingStoreDirty = rect();
+    }
+
+    const QRegion staleRegion = _backingStoreDirty & region;
+    if (staleRegion.isEmpty())
+        return;
+
+    QPainter paint(&_backingStore);
+    paint.setClipRegion(staleRegion);
+
+    foreach (const QRect &rect, staleRegion.rects())
     {
         drawBackground(paint,rect,palette().background().color(),
                        true /* use opacity setting */);
         drawContents(paint, rect);
     }
-    drawInputMethodPreeditString(paint,preeditRect());
-    paintFilters(paint);
+
+    _backingStoreDirty -= staleRegion;
+}
+
+void TerminalDisplay::scrollBackingStore(int dy, const QRect& rect)
+{
+    // parts which have not been drawn yet move along with the contents
+    const QRegion staleRegion = _backingStoreDirty & rect;
+    _backingStoreDirty -= rect;
+    _backingStoreDirty |= staleRegion.translated(0,dy) & rect;
+
+    // the area which is scrolled into view is drawn when updateImage()
+    // finds the lines which have changed, until then it is out of date
+    if (dy < 0)
+        _backingStoreDirty |= QRect(rect.left(), rect.bottom() + 1 + dy, rect.width(), -dy);
+    else
+        _backingStoreDirty |= QRect(rect.left(), rect.top(), rect.width(), dy);
+
+    // QPixmap::scroll() works in device pixels, which only line up with
+    // the character cells if the device pixel ratio is a whole number
+    const qreal ratio = _backingStore.devicePixelRatio();
+    if (!_backingStore.isNull() && ratio == qRound(ratio))
+    {
+        const int scale = qRound(ratio);
+        _backingStore.scroll(0, dy * scale,
+                             QRect(rect.topLeft() * scale, rect.size() * scale));
+    }
+    else
+    {
+        _backingStoreDirty |= rect;
+    }
+
+    update(rect);
 }
 
 QPoint TerminalDisplay::cursorPosition() const
@@ -1377,7 +1634,7 @@ void TerminalDisplay::paintFilters(QPainter& painter)
             // display in _columns
 
             // ignore whitespace at the end of the lines
-            while ( QChar(_image[loc(endColumn,line)].character).isSpace() && endColumn > 0 )
+            while ( QChar::isSpace(_image[loc(endColumn,line)].character) && endColumn > 0 )
                 endColumn--;
 
             // increment here because the column which we want to set 'endColumn' to
@@ -1439,15 +1696,37 @@ void TerminalDisplay::drawContents(QPainter &paint, const QRect &rect)
     int rlx = qMin(_usedColumns-1, qMax(0,(rect.right()  - tLx - _leftMargin ) / _fontWidth));
     int rly = qMin(_usedLines-1,   qMax(0,(rect.bottom() - tLy - _topMargin  ) / _fontHeight));
 
-    const int bufferSize = _usedColumns;
+    // characters outside of the basic multilingual plane take two code units,
+    // and a cell can hold a sequence of them
+    const int bufferSize = _usedColumns * 2 * ExtendedCharTable::MaxSequenceLength;
+    const ExtendedCharTable* extendedChars = _screenWindow ? _screenWindow->extendedCharTable() : 0;
     QString unistr;
     unistr.reserve(bufferSize);
+
+    // the fragments only change the painter's pen and font, which
+    // are restored once all of them have been drawn
+    paint.save();
+
     for (int y = luy; y <= rly; y++)
     {
-        quint16 c = _image[loc(lux,y)].character;
+        uint c = _image[loc(lux,y)].character;
         int x = lux;
         if(!c && x)
             x--; // Search for start of multi-column character
+
+        // the backgrounds of lines drawn at their normal size are filled
+        // before the text, with as few fills as possible.  double width and
+        // double height lines draw the background with each fragment
+        const bool scaledLine = y < _lineProperties.size() &&
+                                (_lineProperties[y] & (LINE_DOUBLEWIDTH | LINE_DOUBLEHEIGHT));
+        if (!scaledLine)
+        {
+            int endColumn = rlx;
+            if (endColumn+1 < _usedColumns && !_image[loc(endColumn+1,y)].character)
+                endColumn++; // include the trailing part of a multi-column character
+            drawLineBackground(paint,tLx,tLy,x,endColumn,y);
+        }
+
         for (; x <= rlx; x++)
         {
             int len = 1;
@@ -1461,14 +1740,8 @@ void TerminalDisplay::drawContents(QPainter &paint, const QRect &rect)
             if ( _image[loc(x,y)].rendition & RE_EXTENDED_CHAR )
             {
                 // sequence of characters
-                ushort extendedCharLength = 0;
-                ushort* chars = ExtendedCharTable::instance
-                        .lookupExtendedChar(_image[loc(x,y)].charSequence,extendedCharLength);
-                for ( int index = 0 ; index < extendedCharLength ; index++ )
-                {
-                    Q_ASSERT( p < bufferSize );
-                    disstrU[p++] = chars[index];
-                }
+                appendExtendedChar(disstrU, p, _image[loc(x,y)].character, extendedChars);
+                c = 0;
             }
             else
             {
@@ -1477,7 +1750,7 @@ void TerminalDisplay::drawContents(QPainter &paint, const QRect &rect)
                 if (c)
                 {
                     Q_ASSERT( p < bufferSize );
-                    disstrU[p++] = c; //fontMap(c);
+                    appendCharacter(disstrU, p, c); //fontMap(c);
                 }
             }
 
@@ -1494,8 +1767,10 @@ void TerminalDisplay::drawContents(QPainter &paint, const QRect &rect)
                    (_image[ qMin(loc(x+len,y)+1,_imageSize) ].character == 0) == doubleWidth &&
                    isLineChar( c = _image[loc(x+len,y)].character) == lineDraw) // Assignment!
             {
-                if (c)
-                    disstrU[p++] = c; //fontMap(c);
+                if (currentRendition & RE_EXTENDED_CHAR)
+                    appendExtendedChar(disstrU, p, c, extendedChars);
+                else if (c)
+                    appendCharacter(disstrU, p, c); //fontMap(c);
                 if (doubleWidth) // assert((_image[loc(x+len,y)+1].character == 0)), see above if condition
                     len++; // Skip trailing part of multi-column character
                 len++;
@@ -1536,6 +1811,14 @@ void TerminalDisplay::drawContents(QPainter &paint, const QRect &rect)
             //(instead of textArea.topLeft() * painter-scale)
             textArea.moveTopLeft( textScale.inverted().map(textArea.topLeft()) );
 
+            if (scaledLine)
+            {
+                const QColor backgroundColor = currentBackground.color(_colorTable);
+                if ( backgroundColor != palette().background().color() )
+                    drawBackground(paint,textArea,backgroundColor,
+                                   false /* do not use transparency */);
+            }
+
             //paint text fragment
             drawTextFragment(    paint,
                                  textArea,
@@ -1563,6 +1846,8 @@ void TerminalDisplay::drawContents(QPainter &paint, const QRect &rect)
             x += len - 1;
         }
     }
+
+    paint.restore();
 }
 
 void TerminalDisplay::blinkEvent()
@@ -1571,10 +1856,19 @@ void TerminalDisplay::blinkEvent()
 
     _blinking = !_blinking;
 
-    //TODO:  Optimize to only repaint the areas of the widget
-    // where there is blinking text
-    // rather than repainting the whole widget.
-    update();
+    updateBlinkingText();
+}
+
+void TerminalDisplay::updateBlinkingText()
+{
+    QRegion region;
+    for (int line = 0; line < _blinkingLines.size(); line++)
+    {
+        if (_blinkingLines.testBit(line))
+            region |= imageToWidget(QRect(0,line,_usedColumns,1));
+    }
+
+    updateContents(region);
 }
 
 QRect TerminalDisplay::imageToWidget(const QRect& imageArea) const
@@ -1591,7 +1885,7 @@ QRect TerminalDisplay::imageToWidget(const QRect& imageArea) const
 void TerminalDisplay::updateCursor()
 {
     QRect cursorRect = imageToWidget( QRect(cursorPosition(),QSize(1,1)) );
-    update(cursorRect);
+    updateContents(cursorRect);
 }
 
 void TerminalDisplay::blinkCursorEvent()
@@ -1745,7 +2039,7 @@ void TerminalDisplay::setScrollBarPosition(ScrollBarPosition position)
     _scrollbarLocation = position;
 
     propagateSize();
-    update();
+    updateContents();
 }
 
 void TerminalDisplay::mousePressEvent(QMouseEvent* ev)
@@ -1848,8 +2142,13 @@ void TerminalDisplay::mouseMoveEvent(QMouseEvent* ev)
     // handle filters
     // change link hot-spot appearance on mouse-over
     Filter::HotSpot* spot = _filterChain->hotSpotAt(charLine,charColumn);
-    if ( spot && spot->type() == Filter::HotSpot::Link)
+    if ( spot && spot == _mouseOverHotspot )
     {
+        // still over the same link, its area and tooltip are up to date
+    }
+    else if ( spot && spot->type() == Filter::HotSpot::Link)
+    {
+        _mouseOverHotspot = spot;
         QRegion previousHotspotArea = _mouseOverHotspotArea;
         _mouseOverHotspotArea = QRegion();
         QRect r;
@@ -1893,6 +2192,7 @@ void TerminalDisplay::mouseMoveEvent(QMouseEvent* ev)
         update( _mouseOverHotspotArea );
         // set hotspot area to an invalid rectangle
         _mouseOverHotspotArea = QRegion();
+        _mouseOverHotspot = 0;
     }
 
     // for auto-hiding the cursor, we need mouseTracking
@@ -2331,7 +2631,7 @@ void TerminalDisplay::mouseDoubleClickEvent(QMouseEvent* ev)
         endSel.setX(x);
 
         // In word selection mode don't select @ (64) if at end of word.
-        if ( ( QChar( _image[i].character ) == '@' ) && ( ( endSel.x() - bgnSel.x() ) > 0 ) )
+        if ( ( _image[i].character == '@' ) && ( ( endSel.x() - bgnSel.x() ) > 0 ) )
             endSel.setX( x - 1 );
 
 
@@ -2471,8 +2771,13 @@ bool TerminalDisplay::focusNextPrevChild( bool next )
 }
 
 
-QChar TerminalDisplay::charClass(QChar qch) const
+QChar TerminalDisplay::charClass(uint ch) const
 {
+    // characters outside of the basic multilingual plane, such as emoji,
+    // are treated as part of a word
+    if ( QChar::requiresSurrogates(ch) ) return 'a';
+
+    const QChar qch(ch);
     if ( qch.isSpace() ) return ' ';
 
     if ( qch.isLetterOrNumber() || _wordCharacters.contains(qch, Qt::CaseInsensitive ) )
@@ -2829,7 +3134,7 @@ void TerminalDisplay::swapColorTable()
     _colorTable[1]=_colorTable[0];
     _colorTable[0]= color;
     _colorsInverted = !_colorsInverted;
-    update();
+    updateContents();
 }
 
 void TerminalDisplay::clearImage()
@@ -2896,6 +3201,7 @@ void TerminalDisplay::makeImage()
     // We over-commit one character so that we can be more relaxed in dealing with
     // certain boundary conditions: _image[_imageSize] is a valid but unused position
     _image = new Character[_imageSize+1];
+    _compareAllLines = true;
 
     clearImage();
 }
@@ -30,11 +30,17 @@
 // Own includes
 #include "Filter.h"
 #include "Character.h"
+class GlyphAtlas;
 class ScreenWindow;
 
 // Qt
+#include <QBitArray>
+#include <QCache>
 #include <QColor>
+#include <QPixmap>
 #include <QPointer>
+#include <QRegion>
+#include <QStaticText>
 #include <QWidget>
 class QDrag;
 class QDragEnterEvent;
@@ -412,6 +418,33 @@ public:
      */
     bool isBidiEnabled() { return _bidiEnabled; }
 
+    /**
+     * This enum describes the methods which the display can use
+     * to draw text.  See setTextRenderingMode()
+     */
+    enum TextRenderingMode
+    {
+        /** Text is laid out and drawn by QPainter. */
+        PainterRendering,
+        /**
+         * Each character is rendered once into a glyph atlas and copied
+         * from there into the display.  This is considerably faster when
+         * lots of output scrolls past, especially without a GPU, but
+         * characters which reach beyond their cell are clipped.  Text
+         * which does not fit onto the character grid, such as combining
+         * characters and line graphics, is still drawn by QPainter.
+         */
+        GlyphAtlasRendering
+    };
+    /**
+     * Sets the method used to draw text.  Defaults to PainterRendering.
+     */
+    void setTextRenderingMode(TextRenderingMode mode);
+    /**
+     * Returns the method used to draw text.  See setTextRenderingMode()
+     */
+    TextRenderingMode textRenderingMode() const { return _textRenderingMode; }
+
     /**
      * Sets the terminal screen section which is displayed in this widget.
      * When updateImage() is called, the display fetches the latest character image from the
@@ -613,7 +646,7 @@ protected:
     //     - A space (returns ' ')
     //     - Part of a word (returns 'a')
     //     - Other characters (returns the input character)
-    QChar charClass(QChar ch) const;
+    QChar charClass(uint ch) const;
 
     void clearImage();
 
@@ -646,8 +679,13 @@ private:
     // fragments according to their colors and styles and calls
     // drawTextFragment() to draw the fragments
     void drawContents(QPainter &paint, const QRect &rect);
+    // draws the backgrounds of a line of characters, using one fill for
+    // each run of characters with the same background color
+    void drawLineBackground(QPainter& painter, int topLeftX, int topLeftY,
+                            int startColumn, int endColumn, int line);
     // draws a section of text, all the text in this section
-    // has a common color and style
+    // has a common color and style.  the background is drawn
+    // separately, see drawLineBackground()
     void drawTextFragment(QPainter& painter, const QRect& rect,
                           QString text, const Character* style);
     // draws the background for a text fragment
@@ -665,10 +703,28 @@ private:
     // draws a string of line graphics
     void drawLineCharString(QPainter& painter, int x, int y,
                             QString str, const Character* attributes);
+    // draws text using the painter's font, laying it out only the first
+    // time that it is drawn, see _staticTextCache
+    void drawStaticText(QPainter& painter, const QRect& rect, const QString& text);
+    // creates the glyph atlas for the current font and rendering mode
+    void updateGlyphAtlas();
 
     // draws the preedit string for input methods
     void drawInputMethodPreeditString(QPainter& painter , const QRect& rect);
 
+    // -- Backing store --
+
+    // marks 'region' of the backing store as out of date and schedules it
+    // to be repainted.  without arguments, the whole widget is marked
+    void updateContents(const QRegion& region);
+    void updateContents();
+    // draws the out of date parts of the backing store within 'region'
+    void renderBackingStore(const QRegion& region);
+    // scrolls the part of the backing store within 'rect' by 'dy' pixels
+    void scrollBackingStore(int dy, const QRect& rect);
+    // repaints the lines which contain blinking text
+    void updateBlinkingText();
+
     // --
 
     // maps an area in the character image to an area on the widget
@@ -720,6 +776,13 @@ private:
     int  _fontHeight;     // height
     int  _fontWidth;     // width
     int  _fontAscent;     // ascend
+
+    // laid out text fragments, keyed by the font variant (bold, underline)
+    // followed by the text.  cleared when the font changes
+    QCache<QString,QStaticText> _staticTextCache;
+
+    TextRenderingMode _textRenderingMode;
+    GlyphAtlas* _glyphAtlas; // only exists with GlyphAtlasRendering and a fixed-pitch font
     bool _boldIntense;   // Whether intense colors should be rendered with bold font
 
     int _leftMargin;    // offset
@@ -744,6 +807,20 @@ private:
     int _imageSize;
     QVector<LineProperty> _lineProperties;
 
+    // lines of _image may only be skipped by updateImage() if they are known
+    // to match the screen window's image, which is not the case after the
+    // image or the window was replaced
+    bool _compareAllLines;
+    QBitArray _blinkingLines; // lines of _image which contain blinking text
+    QVector<char> _dirtyMask; // scratch buffer of updateImage()
+
+    // the background and contents of the widget are drawn into the backing
+    // store when they change, and paintEvent() copies them from there.
+    // exposures and the overlays (hotspots, input method preedit string)
+    // therefore do not redraw the text
+    QPixmap _backingStore;
+    QRegion _backingStoreDirty; // areas of _backingStore which do not match _image
+
     ColorEntry _colorTable[TABLE_COLORS];
     uint _randomSeed;
 
@@ -778,6 +855,7 @@ private:
     bool _isFixedSize; //Columns / lines are locked.
     QTimer* _blinkTimer;  // active when hasBlinker
     QTimer* _blinkCursorTimer;  // active when hasBlinkingCursor
+    QTimer* _filterTimer;  // active when the filters ran out of time
 
     //QMenu* _drop;
     QString _dropText;
@@ -808,6 +886,7 @@ private:
     // search highlight
     TerminalImageFilterChain* _filterChain;
     QRegion _mouseOverHotspotArea;
+    Filter::HotSpot* _mouseOverHotspot;  // the link _mouseOverHotspotArea covers
 
     KeyboardCursorShape _cursorShape;
 
@@ -829,6 +908,8 @@ private:
 
     //the delay in milliseconds between redrawing blinking text
     static const int TEXT_BLINK_DELAY = 500;
+    //the delay in milliseconds before the filters continue with the blocks they had no time for
+    static const int FILTER_CONTINUE_DELAY = 16;
     static const int DEFAULT_LEFT_MARGIN = 1;
     static const int DEFAULT_TOP_MARGIN = 1;
 
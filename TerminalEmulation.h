@@ -30,6 +30,10 @@
 #pragma once
 
 // Own includes
+#include "Character.h"
+#include "ScreenSnapshot.h"
+#include "Utf8Decoder.h"
+class ByteQueue;
 class KeyboardTranslator;
 class HistoryType;
 class Screen;
@@ -42,6 +46,7 @@ class TerminalCharacterDecoder;
 // Qt includes
 #include <QKeyEvent>
 #include <QTextCodec>
+#include <QElapsedTimer>
 #include <QTextStream>
 #include <QTimer>
 
@@ -69,6 +74,30 @@ enum {
     NOTIFYSILENCE=3
 };
 
+/**
+ * Counters describing how output from the terminal is passed on to the
+ * views in frames.  See TerminalEmulation::outputStatistics()
+ */
+struct OutputStatistics
+{
+    OutputStatistics() : framesEmitted(0), framesDropped(0), bytesReceived(0) {}
+
+    /** Number of times outputChanged() has been emitted. */
+    quint64 framesEmitted;
+    /**
+     * Number of display refreshes which passed without a frame while
+     * output was waiting, because frames were being throttled to the
+     * speed at which the views could take them.
+     */
+    quint64 framesDropped;
+    /** Number of bytes received from the terminal program. */
+    quint64 bytesReceived;
+
+    /** Returns the average number of bytes received per frame. */
+    qreal bytesPerFrame() const
+    { return framesEmitted ? qreal(bytesReceived) / framesEmitted : 0; }
+};
+
 /**
  * Base class for terminal emulation back-ends.
  *
@@ -95,6 +124,12 @@ enum {
  * of output changes from the screen window which they are associated with and updating
  * accordingly.
  *
+ * The emulation can be moved to a thread of its own, so that a burst of output does not hold
+ * up the views.  At the end of each frame it then publishes a snapshot of the screen which the
+ * screen windows read on the GUI thread.  While it modifies its screens it holds a lock which
+ * the screen windows take when they have to access a screen directly.  Once the emulation has
+ * been moved, its slots must only be invoked through queued connections.
+ *
  * The emulation also is also responsible for converting input from the connected views such
  * as keypresses and mouse activity into a character string which can be sent
  * to the terminal program.  Key presses can be processed by calling the sendKeyEvent() slot,
@@ -214,6 +249,25 @@ public:
    */
     bool programUsesMouse() const;
 
+    /**
+   * Returns counters describing how the output received so far
+   * has been passed on to the views.
+   */
+    const OutputStatistics& outputStatistics() const { return _outputStatistics; }
+    /** Resets the counters returned by outputStatistics() */
+    void resetOutputStatistics() { _outputStatistics = OutputStatistics(); }
+
+    /**
+     * Sets a queue which incoming data is read from, as an alternative to
+     * calling receiveData() for every block of data.  The queue is typically
+     * filled by a thread which reads from the terminal program.
+     *
+     * Data is taken from the queue whenever it emits dataAvailable(), at
+     * most a bounded amount at a time so that the event loop keeps up with
+     * user input and painting while the terminal program is busy.
+     */
+    void setReceiveQueue(ByteQueue* queue);
+
 public slots: 
 
     /** Change the size of the emulation's image */
@@ -248,8 +302,8 @@ public slots:
 
     /**
    * Processes an incoming stream of characters.  receiveData() decodes the incoming
-   * character buffer using the current codec(), and then calls receiveChar() for
-   * each unicode character in the resulting buffer.
+   * character buffer using the current codec(), and then passes the resulting
+   * unicode characters to receiveChars().
    *
    * receiveData() also starts a timer which causes the outputChanged() signal
    * to be emitted when it expires.  The timer allows multiple updates in quick
@@ -386,10 +440,16 @@ protected:
 
     /**
    * Processes an incoming character.  See receiveData()
-   * @p ch A unicode character code.
+   * @p ch A unicode code point.
    */
     virtual void receiveChar(int ch);
 
+    /**
+   * Processes a buffer of incoming unicode code points.  The default implementation
+   * calls receiveChar() for each character in @p text.
+   */
+    virtual void receiveChars(const uint* text, int length);
+
     /**
    * Sets the active screen.  The terminal has two screens, primary and alternate.
    * The primary screen is used by default.  When certain interactive programs such
@@ -422,13 +482,20 @@ protected:
     //the current text codec.  (this allows for rendering of non-ASCII characters in text files etc.)
     const QTextCodec* _codec;
     QTextDecoder* _decoder;
+    Utf8Decoder _utf8Decoder; // used instead of _decoder when the codec is UTF-8
     const KeyboardTranslator* _keyTranslator; // the keyboard layout
 
+    // sequences of combining characters in the cells of both screens
+    ExtendedCharTable _extendedChars;
+
 protected slots:
     /**
    * Schedules an update of attached views.
    * Repeated calls to bufferedUpdate() in close succession will result in only a single update,
    * much like the Qt buffered update of widgets.
+   *
+   * Updates are paced to the refresh rate of the display, and further slowed
+   * down when the views take longer than a refresh to process an update.
    */
     void bufferedUpdate();
 
@@ -440,10 +507,29 @@ private slots:
 
     void usesMouseChanged(bool usesMouse);
 
+    // reads and processes the data waiting in the receive queue
+    void receiveQueuedData();
+
 private:
+    // reclaims the entries of _extendedChars which are no longer used by
+    // either screen or the history
+    void collectExtendedChars();
+    // publishes a snapshot of the current screen to the windows
+    void takeSnapshot();
+
     bool _usesMouse;
-    QTimer _bulkTimer1;
-    QTimer _bulkTimer2;
+
+    QTimer _frameTimer;
+    QElapsedTimer _lastFrame;       // time since outputChanged() was last emitted
+    QElapsedTimer _pendingSince;    // time since the oldest update not yet emitted
+    int _refreshInterval;           // refresh interval of the display in ms
+    int _frameInterval;             // current minimum time between frames in ms
+    OutputStatistics _outputStatistics;
+    ByteQueue* _receiveQueue;
+
+    ScreenSnapshotBuffer _snapshots;
+    qint64 _scrolledLines;          // lines scrolled on the current screens so far
+    qint64 _droppedLines;           // lines dropped from the history so far
 
 };
 
@@ -0,0 +1,105 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own includes
+#include "Utf8Decoder.h"
+
+// System includes
+#include <string.h>
+
+int Utf8Decoder::decode(const char* text, int length, uint* output)
+{
+    const uchar* in = reinterpret_cast<const uchar*>(text);
+    const uchar* end = in + length;
+    uint* out = output;
+
+    while (in < end)
+    {
+        if (_pending == 0)
+        {
+            // plain ASCII is copied across a word at a time
+            while (end - in >= 8)
+            {
+                quint64 word;
+                memcpy(&word, in, 8);
+                if (word & Q_UINT64_C(0x8080808080808080))
+                    break;
+                for (int i = 0; i < 8; i++)
+                    out[i] = in[i];
+                in += 8;
+                out += 8;
+            }
+            if (in == end)
+                break;
+
+            const uchar c = *in++;
+            if (c < 0x80)
+            {
+                *out++ = c;
+            }
+            else if (c >= 0xc2 && c <= 0xdf)
+            {
+                _codePoint = c & 0x1f;
+                _pending = 1;
+                _minimum = 0x80;
+            }
+            else if (c >= 0xe0 && c <= 0xef)
+            {
+                _codePoint = c & 0x0f;
+                _pending = 2;
+                _minimum = 0x800;
+            }
+            else if (c >= 0xf0 && c <= 0xf4)
+            {
+                _codePoint = c & 0x07;
+                _pending = 3;
+                _minimum = 0x10000;
+            }
+            else
+            {
+                *out++ = 0xfffd;
+            }
+            continue;
+        }
+
+        const uchar c = *in;
+        if ((c & 0xc0) != 0x80)
+        {
+            // the sequence ended early, the byte is decoded on its own
+            *out++ = 0xfffd;
+            _pending = 0;
+            continue;
+        }
+        in++;
+
+        _codePoint = (_codePoint << 6) | (c & 0x3f);
+        if (--_pending > 0)
+            continue;
+
+        if (_codePoint < _minimum || _codePoint > 0x10ffff ||
+            (_codePoint >= 0xd800 && _codePoint <= 0xdfff))
+        {
+            *out++ = 0xfffd;
+        }
+        else
+        {
+            *out++ = _codePoint;
+        }
+    }
+
+    return out - output;
+}
@@ -0,0 +1,51 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#pragma once
+
+// Qt includes
+#include <QtGlobal>
+
+/**
+ * Decodes a UTF-8 byte stream into unicode code points without allocating.
+ *
+ * The decoder keeps the state of a multi-byte sequence which is split
+ * across calls to decode(), so that the stream can be fed in arbitrary
+ * chunks as it arrives.  Malformed input is replaced with U+FFFD.
+ */
+class Utf8Decoder
+{
+public:
+    Utf8Decoder() { reset(); }
+
+    /** Discards a partially received sequence. */
+    void reset() { _codePoint = 0; _pending = 0; _minimum = 0; }
+
+    /**
+     * Decodes @p length bytes from @p text into @p output and returns the
+     * number of code points written.  @p output must have room for
+     * @p length + 1 code points: a sequence left unfinished by the previous
+     * call which the first byte does not continue is replaced with U+FFFD,
+     * and that byte is then decoded on its own.
+     */
+    int decode(const char* text, int length, uint* output);
+
+private:
+    uint _codePoint;    // bits of the sequence received so far
+    int  _pending;      // number of continuation bytes still expected
+    uint _minimum;      // smallest code point the sequence may encode
+};
@@ -166,17 +166,19 @@ void Vt102Emulation::reset()
 
 /* The tokenizer's state
 
-   The state is represented by the buffer (tokenBuffer, tokenBufferPos),
-   and accompanied by decoded arguments kept in (argv,argc).
+   The state is represented by the current parser state (_parserState), and
+   accompanied by decoded arguments kept in (argv,argc), the charset selector
+   of an ESC ( sequence (_intermediate) and the text of an OSC (_oscText).
    Note that they are kept internal in the tokenizer.
 */
 
 void Vt102Emulation::resetTokenizer()
 {
-    tokenBufferPos = 0;
+    _parserState = GroundState;
     argc = 0;
     argv[0] = 0;
     argv[1] = 0;
+    argv[2] = 0;
 }
 
 void Vt102Emulation::addDigit(int digit)
@@ -191,143 +193,216 @@ void Vt102Emulation::addArgument()
     argv[argc] = 0;
 }
 
-void Vt102Emulation::addToCurrentToken(int cc)
+#define ESC 27
+#define CNTL(c) ((c)-'@')
+
+// Actions performed by the tokenizer on a transition
+enum
+{
+    ActionIgnore,               // drop the character
+    ActionPrint,                // display the character
+    ActionExecute,              // execute a control character within the current sequence
+    ActionCancel,               // CAN or SUB, abort the current sequence
+    ActionEscape,               // start a new escape sequence
+    ActionCsi8,                 // the 8-bit CSI, only a control sequence in ANSI mode
+    ActionCollect,              // remember the charset selector
+    ActionParam,                // add a digit to the current argument
+    ActionSeparator,            // start the next argument
+    ActionEscDispatch,
+    ActionCharsetDispatch,
+    ActionLineAttributeDispatch,
+    ActionCsiPnDispatch,
+    ActionCsiPsDispatch,
+    ActionCsiResizeDispatch,
+    ActionCsiPrDispatch,
+    ActionCsiPgDispatch,
+    ActionCsiPeDispatch,
+    ActionOscStart,
+    ActionOscPut,
+    ActionOscEnd,
+    ActionVt52Dispatch,
+    ActionVt52Row,
+    ActionVt52CursorDispatch
+};
+
+#define TRANSITION(action,state) ((quint16)((action) | ((state) << 8)))
+
+static void setTransitions(quint16* row, int first, int last, int action, int state)
 {
-    tokenBuffer[tokenBufferPos] = cc;
-    tokenBufferPos = qMin(tokenBufferPos+1,MAX_TOKEN_LENGTH-1);
+    for (int cc = first; cc <= last; ++cc)
+        row[cc] = TRANSITION(action, state);
 }
 
-// Character Class flags used while decoding
-
-#define CTL  1  // Control character
-#define CHR  2  // Printable character
-#define CPN  4  // TODO: Document me 
-#define DIG  8  // Digit
-#define SCS 16  // TODO: Document me  
-#define GRP 32  // TODO: Document me
-#define CPS 64  // Character which indicates end of window resize
-// escape sequence '\e[8;<row>;<col>t'
-
-void Vt102Emulation::initTokenizer()
-{ 
-    int i;
-    quint8* s;
-    for(i = 0;i < 256; ++i)
-        charClass[i] = 0;
-    for(i = 0;i < 32; ++i)
-        charClass[i] |= CTL;
-    for(i = 32;i < 256; ++i)
-        charClass[i] |= CHR;
-    for(s = (quint8*)"@ABCDGHILMPSTXZcdfry"; *s; ++s)
-        charClass[*s] |= CPN;
-    // resize = \e[8;<row>;<col>t
-    for(s = (quint8*)"t"; *s; ++s)
-        charClass[*s] |= CPS;
-    for(s = (quint8*)"0123456789"; *s; ++s)
-        charClass[*s] |= DIG;
-    for(s = (quint8*)"()+*%"; *s; ++s)
-        charClass[*s] |= SCS;
-    for(s = (quint8*)"()+*#[]%"; *s; ++s)
-        charClass[*s] |= GRP;
-
-    resetTokenizer();
+static void setTransitions(quint16* row, const char* chars, int action, int state)
+{
+    for (const quint8* s = (const quint8*)chars; *s; ++s)
+        row[*s] = TRANSITION(action, state);
 }
 
-/* Ok, here comes the nasty part of the decoder.
-
-   Instead of keeping an explicit state, we deduce it from the
-   token scanned so far. It is then immediately combined with
-   the current character to form a scanning decision.
-
-   This is done by the following defines.
-
-   - P is the length of the token scanned so far.
-   - L (often P-1) is the position on which contents we base a decision.
-   - C is a character or a group of characters (taken from 'charClass').
-   
-   - 'cc' is the current character
-   - 's' is a pointer to the start of the token buffer
-   - 'p' is the current position within the token buffer
-
-   Note that they need to applied in proper order.
+/* The transition table
+
+   Every character is looked up in the row of the current state, which
+   gives the action to perform with it and the state to enter next.  This
+   follows the DEC ANSI parser, with the following peculiarities of the
+   VT100 and of xterm:
+
+   - Control characters are executed in the middle of a sequence without
+     disturbing it, except for CAN and SUB which abort it, and ESC which
+     starts a new one.
+   - DEL is ignored everywhere.
+   - OSC strings end with BEL or ST, DCS, SOS, PM and APC strings are
+     consumed up to ST and ignored.
+   - Only the characters seen so far are kept in the state, so sequences
+     of any length are decoded without a token buffer.
 */
 
-#define lec(P,L,C) (p == (P) && s[(L)] == (C))
-#define lun(     ) (p ==  1  && cc >= 32 )
-#define les(P,L,C) (p == (P) && s[L] < 256 && (charClass[s[(L)]] & (C)) == (C))
-#define eec(C)     (p >=  3  && cc == (C))
-#define ees(C)     (p >=  3  && cc < 256 && (charClass[cc] & (C)) == (C))
-#define eps(C)     (p >=  3  && s[2] != '?' && s[2] != '!' && s[2] != '>' && cc < 256 && (charClass[cc] & (C)) == (C))
-#define epp( )     (p >=  3  && s[2] == '?')
-#define epe( )     (p >=  3  && s[2] == '!')
-#define egt( )     (p >=  3  && s[2] == '>')
-#define Xpe        (tokenBufferPos >= 2 && tokenBuffer[1] == ']')
-#define Xte        (Xpe      && cc ==  7 )
-#define ces(C)     (cc < 256 && (charClass[cc] & (C)) == (C) && !Xte)
-
-#define ESC 27
-#define CNTL(c) ((c)-'@')
+void Vt102Emulation::initTokenizer()
+{
+    for (int state = 0; state < ParserStateCount; ++state)
+    {
+        quint16* row = _transitions[state];
+        setTransitions(row, 0, 31, ActionExecute, state);
+        setTransitions(row, CNTL('X'), CNTL('X'), ActionCancel, GroundState);
+        setTransitions(row, CNTL('Z'), CNTL('Z'), ActionCancel, GroundState);
+        setTransitions(row, ESC, ESC, ActionEscape, EscapeState);
+        setTransitions(row, 32, 255, ActionIgnore, state);
+    }
 
-// process an incoming unicode character
-void Vt102Emulation::receiveChar(int cc)
-{ 
-    if (cc == 127)
-        return; //VT100: ignore.
+    quint16* row = _transitions[GroundState];
+    setTransitions(row, 32, 255, ActionPrint, GroundState);
+    setTransitions(row, ESC+128, ESC+128, ActionCsi8, GroundState);
 
-    if (ces(CTL))
+    // within a string ESC \ (ST) ends it, anything else is an escape sequence
+    const int escapeStates[] = { EscapeState, OscEscapeState, StringEscapeState };
+    for (int i = 0; i < 3; ++i)
     {
-        // DEC HACK ALERT! Control Characters are allowed *within* esc sequences in VT100
-        // This means, they do neither a resetTokenizer() nor a pushToToken(). Some of them, do
-        // of course. Guess this originates from a weakly layered handling of the X-on
-        // X-off protocol, which comes really below this level.
-        if (cc == CNTL('X') || cc == CNTL('Z') || cc == ESC)
-            resetTokenizer(); //VT100: CAN or SUB
-        if (cc != ESC)
-        {
-            processToken(TY_CTL(cc+'@' ),0,0);
-            return;
-        }
+        row = _transitions[escapeStates[i]];
+        setTransitions(row, 32, 255, ActionEscDispatch, GroundState);
+        setTransitions(row, "()+*%", ActionCollect, CharsetState);
+        setTransitions(row, "#", ActionIgnore, LineAttributeState);
+        setTransitions(row, "[", ActionIgnore, CsiEntryState);
+        setTransitions(row, "]", ActionOscStart, OscState);
+        setTransitions(row, "PX^_", ActionIgnore, StringState);
     }
-    // advance the state
-    addToCurrentToken(cc);
+    setTransitions(_transitions[OscEscapeState], "\\", ActionOscEnd, GroundState);
+    setTransitions(_transitions[StringEscapeState], "\\", ActionIgnore, GroundState);
 
-    int* s = tokenBuffer;
-    int  p = tokenBufferPos;
+    setTransitions(_transitions[CharsetState], 32, 255, ActionCharsetDispatch, GroundState);
+    setTransitions(_transitions[LineAttributeState], 32, 255, ActionLineAttributeDispatch, GroundState);
 
-    if (getMode(MODE_Ansi))
+    // the first character after ESC [ may select a private parameter set
+    const int csiStates[] = { CsiEntryState, CsiParamState, CsiPrivateState, CsiSecondaryState, CsiExclaimState };
+    const int csiParamStates[] = { CsiParamState, CsiParamState, CsiPrivateState, CsiSecondaryState, CsiExclaimState };
+    const int csiDispatch[] = { ActionCsiPsDispatch, ActionCsiPsDispatch, ActionCsiPrDispatch, ActionCsiPgDispatch, ActionCsiPeDispatch };
+    for (int i = 0; i < 5; ++i)
     {
-        if (lec(1,0,ESC)) { return; }
-        if (lec(1,0,ESC+128)) { s[0] = ESC; receiveChar('['); return; }
-        if (les(2,1,GRP)) { return; }
-        if (Xte         ) { processWindowAttributeChange(); resetTokenizer(); return; }
-        if (Xpe         ) { return; }
-        if (lec(3,2,'?')) { return; }
-        if (lec(3,2,'>')) { return; }
-        if (lec(3,2,'!')) { return; }
-        if (lun(       )) { processToken( TY_CHR(), applyCharset(cc), 0);   resetTokenizer(); return; }
-        if (lec(2,0,ESC)) { processToken( TY_ESC(s[1]), 0, 0);              resetTokenizer(); return; }
-        if (les(3,1,SCS)) { processToken( TY_ESC_CS(s[1],s[2]), 0, 0);      resetTokenizer(); return; }
-        if (lec(3,1,'#')) { processToken( TY_ESC_DE(s[2]), 0, 0);           resetTokenizer(); return; }
-        if (eps(    CPN)) { processToken( TY_CSI_PN(cc), argv[0],argv[1]);  resetTokenizer(); return; }
-
+        row = _transitions[csiStates[i]];
+        setTransitions(row, 32, 255, csiDispatch[i], GroundState);
+        setTransitions(row, "0123456789", ActionParam, csiParamStates[i]);
+        setTransitions(row, ";", ActionSeparator, csiParamStates[i]);
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+        row = _transitions[csiStates[i]];
+        setTransitions(row, "@ABCDGHILMPSTXZcdfry", ActionCsiPnDispatch, GroundState);
         // resize = \e[8;<row>;<col>t
-        if (eps(CPS))
-        {
-            processToken( TY_CSI_PS(cc, argv[0]), argv[1], argv[2]);
-            resetTokenizer();
-            return;
-        }
+        setTransitions(row, "t", ActionCsiResizeDispatch, GroundState);
+    }
+
+    row = _transitions[CsiEntryState];
+    setTransitions(row, "?", ActionIgnore, CsiPrivateState);
+    setTransitions(row, ">", ActionIgnore, CsiSecondaryState);
+    setTransitions(row, "!", ActionIgnore, CsiExclaimState);
+
+    row = _transitions[OscState];
+    setTransitions(row, 32, 255, ActionOscPut, OscState);
+    setTransitions(row, CNTL('G'), CNTL('G'), ActionOscEnd, GroundState);
+    setTransitions(row, ESC, ESC, ActionIgnore, OscEscapeState);
+
+    row = _transitions[StringState];
+    setTransitions(row, 0, 255, ActionIgnore, StringState);
+    setTransitions(row, CNTL('X'), CNTL('X'), ActionIgnore, GroundState);
+    setTransitions(row, CNTL('Z'), CNTL('Z'), ActionIgnore, GroundState);
+    setTransitions(row, ESC, ESC, ActionIgnore, StringEscapeState);
+
+    row = _transitions[Vt52EscapeState];
+    setTransitions(row, 32, 255, ActionVt52Dispatch, GroundState);
+    setTransitions(row, "Y", ActionIgnore, Vt52RowState);
+    setTransitions(_transitions[Vt52RowState], 32, 255, ActionVt52Row, Vt52ColumnState);
+    setTransitions(_transitions[Vt52ColumnState], 32, 255, ActionVt52CursorDispatch, GroundState);
+
+    //VT100: ignore DEL
+    for (int state = 0; state < ParserStateCount; ++state)
+        _transitions[state][127] = TRANSITION(ActionIgnore, state);
+
+    _oscText.reserve(256);
+    resetTokenizer();
+}
 
-        if (epe(   )) { processToken( TY_CSI_PE(cc), 0, 0); resetTokenizer(); return; }
-        if (ees(DIG)) { addDigit(cc-'0'); return; }
-        if (eec(';')) { addArgument();    return; }
+// process an incoming unicode character
+void Vt102Emulation::receiveChar(int cc)
+{
+    const int transition = _transitions[_parserState][cc < 256 ? cc : 0xa0];
+    _parserState = transition >> 8;
+
+    switch (transition & 0xff)
+    {
+    case ActionIgnore:
+        break;
+    case ActionPrint:
+        processToken( TY_CHR(), getMode(MODE_Ansi) ? applyCharset(cc) : cc, 0);
+        break;
+    case ActionExecute:
+        processToken( TY_CTL(cc+'@'), 0, 0);
+        break;
+    case ActionCancel:
+        //VT100: CAN or SUB
+        resetTokenizer();
+        processToken( TY_CTL(cc+'@'), 0, 0);
+        break;
+    case ActionEscape:
+        resetTokenizer();
+        _parserState = getMode(MODE_Ansi) ? EscapeState : Vt52EscapeState;
+        break;
+    case ActionCsi8:
+        if (getMode(MODE_Ansi))
+            _parserState = CsiEntryState;
+        else
+            processToken( TY_CHR(), cc, 0);
+        break;
+    case ActionCollect:
+        _intermediate = cc;
+        break;
+    case ActionParam:
+        addDigit(cc-'0');
+        break;
+    case ActionSeparator:
+        addArgument();
+        break;
+    case ActionEscDispatch:
+        processToken( TY_ESC(cc), 0, 0);
+        resetTokenizer();
+        break;
+    case ActionCharsetDispatch:
+        processToken( TY_ESC_CS(_intermediate,cc), 0, 0);
+        resetTokenizer();
+        break;
+    case ActionLineAttributeDispatch:
+        processToken( TY_ESC_DE(cc), 0, 0);
+        resetTokenizer();
+        break;
+    case ActionCsiPnDispatch:
+        processToken( TY_CSI_PN(cc), argv[0], argv[1]);
+        resetTokenizer();
+        break;
+    case ActionCsiResizeDispatch:
+        processToken( TY_CSI_PS(cc, argv[0]), argv[1], argv[2]);
+        resetTokenizer();
+        break;
+    case ActionCsiPsDispatch:
         for (int i=0;i<=argc;i++)
         {
-            if (epp())
-                processToken( TY_CSI_PR(cc,argv[i]), 0, 0);
-            else if (egt())
-                processToken( TY_CSI_PG(cc), 0, 0); // spec. case for ESC]>0c or ESC]>c
-            else if (cc == 'm' && argc - i >= 4 && (argv[i] == 38 || argv[i] == 48) && argv[i+1] == 2)
+            if (cc == 'm' && argc - i >= 4 && (argv[i] == 38 || argv[i] == 48) && argv[i+1] == 2)
             {
                 // ESC[ ... 48;2;<red>;<green>;<blue> ... m -or- ESC[ ... 38;2;<red>;<green>;<blue> ... m
                 i += 2;
@@ -344,58 +419,104 @@ void Vt102Emulation::receiveChar(int cc)
                 processToken( TY_CSI_PS(cc,argv[i]), 0, 0);
         }
         resetTokenizer();
-    }
-    else
-    {
-        // VT52 Mode
-        if (lec(1,0,ESC))
-            return;
-        if (les(1,0,CHR))
+        break;
+    case ActionCsiPrDispatch:
+        for (int i=0;i<=argc;i++)
+            processToken( TY_CSI_PR(cc,argv[i]), 0, 0);
+        resetTokenizer();
+        break;
+    case ActionCsiPgDispatch:
+        processToken( TY_CSI_PG(cc), 0, 0); // spec. case for ESC]>0c or ESC]>c
+        resetTokenizer();
+        break;
+    case ActionCsiPeDispatch:
+        processToken( TY_CSI_PE(cc), 0, 0);
+        resetTokenizer();
+        break;
+    case ActionOscStart:
+        _oscText.resize(0);
+        break;
+    case ActionOscPut:
+        if (_oscText.length() < MAX_OSC_LENGTH)
         {
-            processToken( TY_CHR(), s[0], 0);
-            resetTokenizer();
-            return;
+            if (QChar::requiresSurrogates(cc))
+            {
+                _oscText.append(QChar(QChar::highSurrogate(cc)));
+                _oscText.append(QChar(QChar::lowSurrogate(cc)));
+            }
+            else
+                _oscText.append(QChar(cc));
         }
-        if (lec(2,1,'Y'))
-            return;
-        if (lec(3,1,'Y'))
-            return;
-        if (p < 4)
+        break;
+    case ActionOscEnd:
+        processWindowAttributeChange();
+        resetTokenizer();
+        break;
+    case ActionVt52Dispatch:
+        processToken( TY_VT52(cc), 0, 0);
+        resetTokenizer();
+        break;
+    case ActionVt52Row:
+        // the row of ESC Y is kept until the column arrives
+        argv[0] = cc;
+        break;
+    case ActionVt52CursorDispatch:
+        processToken( TY_VT52('Y'), argv[0], cc);
+        resetTokenizer();
+        break;
+    }
+}
+
+// characters which receiveChar() displays as they are in the ground state
+// (C0 controls, DEL and the 8-bit CSI are not)
+#define isPlainChar(cc) ((cc) >= 32 && (cc) != 127 && (cc) != ESC+128)
+
+#define CHAR_RUN_LENGTH 256
+
+// process a buffer of incoming unicode characters
+void Vt102Emulation::receiveChars(const uint* text, int length)
+{
+    uint run[CHAR_RUN_LENGTH];
+
+    int i = 0;
+    while (i < length)
+    {
+        // fast path: outside of an escape sequence, hand whole runs of
+        // printable characters to the screen instead of tokenizing each one
+        if (_parserState == GroundState && getMode(MODE_Ansi) && isPlainChar(text[i]))
         {
-            processToken( TY_VT52(s[1] ), 0, 0);
-            resetTokenizer();
-            return;
+            int n = 0;
+            do {
+                run[n++] = applyCharset(text[i++]);
+            } while (n < CHAR_RUN_LENGTH && i < length && isPlainChar(text[i]));
+
+            _currentScreen->displayCharacters(run, n);
+            continue;
         }
-        processToken( TY_VT52(s[1]), s[2], s[3]);
-        resetTokenizer();
-        return;
+        receiveChar(text[i++]);
     }
 }
+
 void Vt102Emulation::processWindowAttributeChange()
 {
     // Describes the window or terminal session attribute to change
     // See Session::UserTitleChange for possible values
     int attributeToChange = 0;
     int i;
-    for (i = 2; i < tokenBufferPos     &&
-         tokenBuffer[i] >= '0'  &&
-         tokenBuffer[i] <= '9'; i++)
+    for (i = 0; i < _oscText.length() &&
+         _oscText.at(i).unicode() >= '0' &&
+         _oscText.at(i).unicode() <= '9'; i++)
     {
-        attributeToChange = 10 * attributeToChange + (tokenBuffer[i]-'0');
+        attributeToChange = 10 * attributeToChange + (_oscText.at(i).unicode()-'0');
     }
 
-    if (tokenBuffer[i] != ';')
+    if (i == _oscText.length() || _oscText.at(i) != QLatin1Char(';'))
     {
-        reportDecodingError();
+        printf("Undecodable OSC sequence: %s\n", qPrintable(_oscText));
         return;
     }
 
-    QString newValue;
-    newValue.reserve(tokenBufferPos-i-2);
-    for (int j = 0; j < tokenBufferPos-i-2; j++)
-        newValue[j] = tokenBuffer[i+1+j];
-
-    _pendingTitleUpdates[attributeToChange] = newValue;
+    _pendingTitleUpdates[attributeToChange] = _oscText.mid(i+1);
     _titleUpdateTimer->start(20);
 }
 
@@ -777,7 +898,7 @@ void Vt102Emulation::processToken(int token, int p, int q)
     case TY_CSI_PG('c'      ) :  reportSecondaryAttributes(          ); break; //VT100
 
     default:
-        reportDecodingError();
+        reportDecodingError(token);
         break;
     };
 }
@@ -1006,7 +1127,7 @@ void Vt102Emulation::sendKeyEvent( QKeyEvent* event )
 
 // Apply current character map.
 
-unsigned short Vt102Emulation::applyCharset(unsigned short c)
+uint Vt102Emulation::applyCharset(uint c)
 {
     if (CHARSET.graphic && 0x5f <= c && c <= 0x7e) return vt100_graphics[c-0x5f];
     if (CHARSET.pound && c == '#' ) return 0xa3; //This mode is obsolete
@@ -1204,28 +1325,24 @@ char Vt102Emulation::eraseChar() const
         return '\b';
 }
 
-// print contents of the scan buffer
-static void hexdump(int* s, int len)
-{ int i;
-    for (i = 0; i < len; i++)
-    {
-        if (s[i] == '\\')
-            printf("\\\\");
+// print a character of a token
+static void hexdump(int c)
+{
+    if (c == '\\')
+        printf("\\\\");
+    else
+        if (c > 32 && c < 127)
+            printf("%c",c);
         else
-            if ((s[i]) > 32 && s[i] < 127)
-                printf("%c",s[i]);
-            else
-                printf("\\%04x(hex)",s[i]);
-    }
+            printf("\\%04x(hex)",c);
 }
 
-void Vt102Emulation::reportDecodingError()
+void Vt102Emulation::reportDecodingError(int token)
 {
-    if (tokenBufferPos == 0 || ( tokenBufferPos == 1 && (tokenBuffer[0] & 0xff) >= 32) )
-        return;
-    printf("Undecodable sequence: ");
-    hexdump(tokenBuffer,tokenBufferPos);
-    printf("\n");
+    // see TY_CONSTRUCT for the layout of the token
+    printf("Undecodable sequence: type %d, code ", token & 0xff);
+    hexdump((token >> 8) & 0xff);
+    printf(", argument %d\n", (token >> 16) & 0xffff);
 }
 
 //#include "Vt102Emulation.moc"
@@ -98,6 +98,7 @@ protected:
     virtual void setMode(int mode);
     virtual void resetMode(int mode);
     virtual void receiveChar(int cc);
+    virtual void receiveChars(const uint* text, int length);
 
 private slots:
     //causes changeTitle() to be emitted for each (int,QString) pair in pendingTitleUpdates
@@ -105,7 +106,7 @@ private slots:
     void updateTitle();
 
 private:
-    unsigned short applyCharset(unsigned short c);
+    uint applyCharset(uint c);
     void setCharset(int n, int cs);
     void useCharset(int n);
     void setAndUseCharset(int n, int cs);
@@ -127,11 +128,30 @@ private:
     // (except MODE_Allow132Columns)
     void resetModes();
 
+    // States of the tokenizer, see initTokenizer() for the transitions
+    // between them
+    enum ParserState
+    {
+        GroundState,            // printable characters are displayed
+        EscapeState,            // ESC
+        CharsetState,           // ESC followed by one of ( ) * + %
+        LineAttributeState,     // ESC #
+        CsiEntryState,          // ESC [ or the 8-bit CSI
+        CsiParamState,          // ESC [ {Pn} ; ...
+        CsiPrivateState,        // ESC [ ? {Pn} ; ...
+        CsiSecondaryState,      // ESC [ > {Pn} ; ...
+        CsiExclaimState,        // ESC [ ! {Pn} ; ...
+        OscState,               // ESC ] {Pn} ; {Text}
+        OscEscapeState,         // ESC within an OSC string
+        StringState,            // DCS, SOS, PM or APC string, ignored
+        StringEscapeState,      // ESC within an ignored string
+        Vt52EscapeState,        // ESC in VT52 mode
+        Vt52RowState,           // ESC Y in VT52 mode
+        Vt52ColumnState,        // ESC Y {Pc} in VT52 mode
+        ParserStateCount
+    };
+
     void resetTokenizer();
-#define MAX_TOKEN_LENGTH 80
-    void addToCurrentToken(int cc);
-    int tokenBuffer[MAX_TOKEN_LENGTH]; //FIXME: overflow?
-    int tokenBufferPos;
 #define MAXARGS 15
     void addDigit(int dig);
     void addArgument();
@@ -139,12 +159,17 @@ private:
     int argc;
     void initTokenizer();
 
-    // Set of flags for each of the ASCII characters which indicates
-    // what category they fall into (printable character, control, digit etc.)
-    // for the purposes of decoding terminal output
-    int charClass[256];
+    int _parserState;
+    int _intermediate;  // charset selector of an ESC ( ) * + % sequence
+#define MAX_OSC_LENGTH 4096
+    QString _oscText;   // text of the OSC sequence being received
+
+    // For each state and character (characters above 255 are looked up
+    // as 0xa0) the action to perform in the low byte and the state
+    // to enter in the high byte
+    quint16 _transitions[ParserStateCount][256];
 
-    void reportDecodingError();
+    void reportDecodingError(int token);
 
     void processToken(int code, int p, int q);
     void processWindowAttributeChange();
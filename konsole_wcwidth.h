@@ -20,5 +20,20 @@
 #include <QtGlobal>
 class QString;
 
-int konsole_wcwidth(quint16 ucs);
+// two level lookup table of character widths, see konsole_wcwidth.cpp
+extern const uchar konsole_wcwidthPages[0x110000 >> 8];
+extern const uchar konsole_wcwidthTable[][64];
+
+// returns the number of columns taken by the character 'ucs', which is
+// 0 for combining characters, 2 for wide characters and -1 for control
+// characters
+inline int konsole_wcwidth(uint ucs)
+{
+    if (ucs >= 0x110000)
+        return 1;
+    const uint index = ucs & 0xff;
+    const uint page = konsole_wcwidthPages[ucs >> 8];
+    return ((konsole_wcwidthTable[page][index >> 2] >> ((index & 3) * 2)) & 3) - 1;
+}
+
 int string_width( QString txt );
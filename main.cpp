@@ -6,6 +6,8 @@
 #include <QDebug>
 #include <QSsh>
 #include "Shell.h"
+#include "ByteQueue.h"
+#include <QThread>
 #include <QLoggingCategory>
 #include "ColorScheme.h"
 
@@ -22,8 +24,17 @@ int main(int argc, char *argv[])
     parameters.port=22;
     parameters.timeout=10;
 
-    Shell shell(parameters);
-    shell.run();
+    // the connection is serviced on a thread of its own, which hands the
+    // output of the shell to the emulation through a queue
+    QThread ioThread;
+    ByteQueue outputQueue(1024 * 1024);
+    Shell* shell = new Shell(parameters);
+    shell->setOutputQueue(&outputQueue);
+    shell->moveToThread(&ioThread);
+    QObject::connect(&ioThread, &QThread::finished, shell, &QObject::deleteLater);
+    QObject::connect(shell, &Shell::finished, &a, &QCoreApplication::exit, Qt::QueuedConnection);
+    ioThread.start();
+    QMetaObject::invokeMethod(shell, "run", Qt::QueuedConnection);
 
     TerminalEmulation* emulation = new Vt102Emulation();
     TerminalDisplay* display = new TerminalDisplay();
@@ -33,20 +44,26 @@ int main(int argc, char *argv[])
     emulation->setHistory(HistoryTypeBuffer(1000));
     emulation->setCodec(QTextCodec::codecForName("UTF-8"));
 
-    QObject::connect(&shell,&Shell::remoteStdout,[=](QByteArray data){
-        emulation->receiveData(data.data(),data.length());
-    });
-    QObject::connect(emulation,&TerminalEmulation::sendData,[&](const char*data,int len){
+    emulation->setReceiveQueue(&outputQueue);
+    QObject::connect(emulation,&TerminalEmulation::sendData,[=](const char*data,int len){
         QByteArray buf(data,len);
-        shell.writeRemote(buf);
+        QMetaObject::invokeMethod(shell, "writeRemote", Qt::QueuedConnection, Q_ARG(QByteArray, buf));
     });
 
     //addView
+    //the emulation runs on a thread of its own, so events and strings from the
+    //display are copied before they are handed over
     QObject::connect( display , &TerminalDisplay::keyPressedSignal ,[=](QKeyEvent* event){
-        emulation->sendKeyEvent(event);
+        QKeyEvent copy(*event);
+        QMetaObject::invokeMethod(emulation, [=]() mutable {
+            emulation->sendKeyEvent(&copy);
+        }, Qt::QueuedConnection);
     });
     QObject::connect( display , &TerminalDisplay::sendStringToEmu,[=](const char* str){
-        emulation->sendString(str);
+        QByteArray copy(str);
+        QMetaObject::invokeMethod(emulation, [=](){
+            emulation->sendString(copy.constData(), copy.length());
+        }, Qt::QueuedConnection);
     });
     QTimer *resizeTimer=new QTimer(display);
     resizeTimer->setSingleShot(true);
@@ -59,7 +76,8 @@ int main(int argc, char *argv[])
         minColumns = view->columns();
         // backend emulation must have a _terminal of at least 1 column x 1 line in size
         if ( minLines > 0 && minColumns > 0 ) {
-            emulation->setImageSize( minLines , minColumns );
+            QMetaObject::invokeMethod(emulation, "setImageSize", Qt::QueuedConnection,
+                                      Q_ARG(int, minLines), Q_ARG(int, minColumns));
         }
     });
     QObject::connect(display,&TerminalDisplay::changedContentSizeSignal,[&](){
@@ -76,6 +94,16 @@ int main(int argc, char *argv[])
     display->setScrollBarPosition(TerminalDisplay::ScrollBarRight);
     display->setUsesMouse(true);
 
+    QThread emulationThread;
+    emulation->moveToThread(&emulationThread);
+    emulationThread.start();
+
+    const int exitCode = a.exec();
 
-    return a.exec();
+    emulationThread.quit();
+    emulationThread.wait();
+    emulation->setReceiveQueue(0);
+    ioThread.quit();
+    ioThread.wait();
+    return exitCode;
 }
@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+"""Generates the character width tables in konsole_wcwidth.cpp.
+
+The widths follow the rules described at the top of konsole_wcwidth.cpp:
+
+  - U+0000 is 0 columns wide, the other C0/C1 controls and DEL are -1.
+  - Mn, Me and Cf characters (except U+00AD SOFT HYPHEN), U+200B and the
+    Hangul Jamo medial vowels and final consonants U+1160-U+11FF are 0.
+  - East Asian Wide (W) and Fullwidth (F) characters are 2.  Unassigned code
+    points in the CJK ideograph blocks and planes are W by default.
+  - Everything else is 1.
+
+The input is the Unicode Character Database, version 14.0.0:
+
+  https://www.unicode.org/Public/14.0.0/ucd/UnicodeData.txt
+  https://www.unicode.org/Public/14.0.0/ucd/EastAsianWidth.txt
+
+Usage:
+
+  generate_wcwidth.py --ucd DIR [--update konsole_wcwidth.cpp | --intervals]
+
+DIR holds the two files above.  Without --ucd the unicodedata module of
+Python is used instead, which must have been built from the same version
+(Python 3.11 ships 14.0.0).  --update replaces the tables in the given
+source file, --intervals prints the widths as the sorted interval tables
+used by tests/wcwidth_intervals.h.  Without either, the tables are printed.
+"""
+
+import argparse
+import re
+import sys
+
+UNICODE_VERSION = '14.0.0'
+CODE_POINTS = 0x110000
+PAGE_BITS = 8
+
+# unassigned code points which EastAsianWidth.txt gives a default of W
+DEFAULT_WIDE = [(0x3400, 0x4DBF), (0x4E00, 0x9FFF), (0xF900, 0xFAFF),
+                (0x20000, 0x2FFFD), (0x30000, 0x3FFFD)]
+
+
+def read_ucd(directory):
+    """Returns the general category and East Asian width of every code point."""
+    categories = ['Cn'] * CODE_POINTS
+    with open(directory + '/UnicodeData.txt', encoding='utf-8') as f:
+        first = None
+        for line in f:
+            fields = line.split(';')
+            code, name, category = int(fields[0], 16), fields[1], fields[2]
+            if name.endswith(', First>'):
+                first = code
+                continue
+            start = first if name.endswith(', Last>') else code
+            first = None
+            for c in range(start, code + 1):
+                categories[c] = category
+
+    widths = ['N'] * CODE_POINTS
+    entry = re.compile(r'^([0-9A-F]+)(?:\.\.([0-9A-F]+))?;(\w+)')
+    with open(directory + '/EastAsianWidth.txt', encoding='utf-8') as f:
+        for line in f:
+            match = entry.match(line)
+            if not match:
+                continue
+            start = int(match.group(1), 16)
+            end = int(match.group(2), 16) if match.group(2) else start
+            for c in range(start, end + 1):
+                widths[c] = match.group(3)
+
+    return categories, widths
+
+
+def read_unicodedata():
+    import unicodedata
+    if unicodedata.unidata_version != UNICODE_VERSION:
+        sys.exit('unicodedata is version %s, not %s, use --ucd'
+                 % (unicodedata.unidata_version, UNICODE_VERSION))
+    categories = [unicodedata.category(chr(c)) for c in range(CODE_POINTS)]
+    widths = [unicodedata.east_asian_width(chr(c)) for c in range(CODE_POINTS)]
+    return categories, widths
+
+
+def width(c, category, east_asian_width):
+    if c == 0:
+        return 0
+    if c < 0x20 or 0x7f <= c < 0xa0:
+        return -1
+    if c != 0xad and (category in ('Mn', 'Me', 'Cf') or
+                      0x1160 <= c <= 0x11ff or c == 0x200b):
+        return 0
+    if category == 'Cn':
+        return 2 if any(a <= c <= b for a, b in DEFAULT_WIDE) else 1
+    return 2 if east_asian_width in ('W', 'F') else 1
+
+
+def build_pages(widths):
+    """Splits the widths into pages, sharing the pages which are the same."""
+    page_size = 1 << PAGE_BITS
+    index = {}
+    pages = []
+    page_of_block = []
+    for block in range(CODE_POINTS >> PAGE_BITS):
+        page = tuple(widths[block * page_size:(block + 1) * page_size])
+        if page not in index:
+            index[page] = len(pages)
+            pages.append(page)
+        page_of_block.append(index[page])
+    return page_of_block, pages
+
+
+def format_tables(page_of_block, pages):
+    out = []
+    out.append('// index of the page of konsole_wcwidthTable holding the widths of each')
+    out.append('// block of 256 code points')
+    out.append('const uchar konsole_wcwidthPages[0x110000 >> 8] = {')
+    rows = [page_of_block[i:i + 16] for i in range(0, len(page_of_block), 16)]
+    for n, row in enumerate(rows):
+        out.append('    ' + ', '.join('%3d' % v for v in row) + (',' if n < len(rows) - 1 else ''))
+    out.append('};')
+    out.append('')
+    out.append('// widths of the code points in each page plus one, packed into two bits')
+    out.append('// per code point with the first code point in the lowest bits')
+    out.append('const uchar konsole_wcwidthTable[%d][64] = {' % len(pages))
+    for n, page in enumerate(pages):
+        packed = []
+        for i in range(0, len(page), 4):
+            packed.append(sum((page[i + j] + 1) << (2 * j) for j in range(4)))
+        out.append('    { // page %d' % n)
+        out.append(',\n'.join('        ' + ', '.join('0x%02X' % v for v in packed[i:i + 16])
+                              for i in range(0, len(packed), 16)))
+        out.append('    }' + (',' if n < len(pages) - 1 else ''))
+    out.append('};')
+    return '\n'.join(out) + '\n'
+
+
+def intervals(widths, value):
+    result = []
+    start = None
+    for c, w in enumerate(widths + [None]):
+        if w == value and start is None:
+            start = c
+        elif w != value and start is not None:
+            result.append((start, c - 1))
+            start = None
+    return result
+
+
+def format_intervals(widths):
+    def table(name, comment, ranges):
+        items = ['{ 0x%04X, 0x%04X }' % r for r in ranges]
+        lines = ['    ' + ', '.join(items[i:i + 3]) for i in range(0, len(items), 3)]
+        return ('// %s\nstatic const struct interval %s[] = {\n%s\n};\n'
+                % (comment, name, ',\n'.join(lines)))
+
+    return (table('combining', 'sorted list of non-overlapping intervals of zero width characters',
+                  intervals(widths, 0)) + '\n' +
+            table('wide', 'sorted list of non-overlapping intervals of double width characters',
+                  intervals(widths, 2)))
+
+
+def update_source(path, tables):
+    with open(path, newline='') as f:
+        source = f.read()
+    newline = '\r\n' if '\r\n' in source else '\n'
+    source = source.replace('\r\n', '\n')
+
+    begin = source.index('// index of the page of konsole_wcwidthTable')
+    end = source.index('};\n', source.index('const uchar konsole_wcwidthTable')) + 3
+    source = source[:begin] + tables + source[end:]
+
+    with open(path, 'w', newline='') as f:
+        f.write(source.replace('\n', newline))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--ucd', metavar='DIR',
+                        help='directory holding UnicodeData.txt and EastAsianWidth.txt')
+    group = parser.add_mutually_exclusive_group()
+    group.add_argument('--update', metavar='FILE', help='replace the tables in FILE')
+    group.add_argument('--intervals', action='store_true', help='print interval tables')
+    args = parser.parse_args()
+
+    categories, east_asian_widths = read_ucd(args.ucd) if args.ucd else read_unicodedata()
+    widths = [width(c, categories[c], east_asian_widths[c]) for c in range(CODE_POINTS)]
+
+    if args.intervals:
+        sys.stdout.write(format_intervals(widths))
+        return
+
+    tables = format_tables(*build_pages(widths))
+    if args.update:
+        update_source(args.update, tables)
+    else:
+        sys.stdout.write(tables)
+
+
+if __name__ == '__main__':
+    main()
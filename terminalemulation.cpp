@@ -28,6 +28,7 @@
 
 // Own includes
 #include "TerminalEmulation.h"
+#include "ByteQueue.h"
 #include "KeyboardTranslator.h"
 #include "Screen.h"
 #include "TerminalCharacterDecoder.h"
@@ -37,6 +38,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 // Qt includes
@@ -44,25 +46,60 @@
 #include <QClipboard>
 #include <QHash>
 #include <QKeyEvent>
+#include <QMutexLocker>
+#include <QScreen>
 #include <QRegExp>
 #include <QTextStream>
 #include <QThread>
 #include <QTime>
 
+// number of bytes decoded by the UTF-8 decoder at a time
+#define UTF8_CHUNK_LENGTH 1024
+// number of bytes read from the receive queue at a time
+#define RECEIVE_CHUNK_LENGTH 16384
+// number of bytes read from the receive queue before returning to the event loop
+#define RECEIVE_BUDGET 262144
+
+// frame interval in ms when the refresh rate of the display is unknown
+#define DEFAULT_FRAME_INTERVAL 16
+// longest time in ms updates are held back when the views are slow
+#define MAX_FRAME_INTERVAL 200
+
+// number of extended characters at which unused ones are first collected
+#define MIN_COLLECT_THRESHOLD 1024
+// largest key which fits into Character::character
+#define MAX_EXTENDED_CHAR_KEY 0xFFFFFF
+
 TerminalEmulation::TerminalEmulation() :
     _currentScreen(0),
     _codec(0),
     _decoder(0),
     _keyTranslator(0),
-    _usesMouse(false)
+    _usesMouse(false),
+    _frameTimer(this),
+    _refreshInterval(DEFAULT_FRAME_INTERVAL),
+    _frameInterval(DEFAULT_FRAME_INTERVAL),
+    _receiveQueue(0),
+    _scrolledLines(0),
+    _droppedLines(0)
 {
     // create screens with a default size
     _screen[0] = new Screen(40,80);
     _screen[1] = new Screen(40,80);
+    _screen[0]->setExtendedCharTable(&_extendedChars);
+    _screen[1]->setExtendedCharTable(&_extendedChars);
     _currentScreen = _screen[0];
+    takeSnapshot();
 
-    QObject::connect(&_bulkTimer1, SIGNAL(timeout()), this, SLOT(showBulk()) );
-    QObject::connect(&_bulkTimer2, SIGNAL(timeout()), this, SLOT(showBulk()) );
+    // pace updates of the views to the refresh rate of the display
+    QScreen* screen = QGuiApplication::primaryScreen();
+    if (screen && screen->refreshRate() >= 1)
+        _refreshInterval = qMax(1, qRound(1000 / screen->refreshRate()));
+    _frameInterval = _refreshInterval;
+
+    _frameTimer.setSingleShot(true);
+    _frameTimer.setTimerType(Qt::PreciseTimer);
+    QObject::connect(&_frameTimer, SIGNAL(timeout()), this, SLOT(showBulk()) );
 
     // listen for mouse status changes
     connect( this , SIGNAL(programUsesMouseChanged(bool)) ,
@@ -82,7 +119,7 @@ void TerminalEmulation::usesMouseChanged(bool usesMouse)
 ScreenWindow* TerminalEmulation::createWindow()
 {
     ScreenWindow* window = new ScreenWindow();
-    window->setScreen(_currentScreen);
+    window->setSnapshotBuffer(&_snapshots);
     _windows << window;
 
     connect(window , SIGNAL(selectionChanged()),
@@ -109,23 +146,21 @@ TerminalEmulation::~TerminalEmulation()
 
 void TerminalEmulation::setScreen(int n)
 {
-    Screen *old = _currentScreen;
+    // the windows switch to the newly active screen with the next snapshot
     _currentScreen = _screen[n & 1];
-    if (_currentScreen != old)
-    {
-        // tell all windows onto this emulation to switch to the newly active screen
-        foreach(ScreenWindow* window,_windows)
-            window->setScreen(_currentScreen);
-    }
 }
 
 void TerminalEmulation::clearHistory()
 {
+    QMutexLocker locker(_snapshots.screenLock());
     _screen[0]->setScroll( _screen[0]->getScroll() , false );
 }
 void TerminalEmulation::setHistory(const HistoryType& t)
 {
-    _screen[0]->setScroll(t);
+    {
+        QMutexLocker locker(_snapshots.screenLock());
+        _screen[0]->setScroll(t);
+    }
 
     showBulk();
 }
@@ -144,6 +179,7 @@ void TerminalEmulation::setCodec(const QTextCodec * qtc)
 
     delete _decoder;
     _decoder = _codec->makeDecoder();
+    _utf8Decoder.reset();
 
     emit useUtf8Request(utf8());
 }
@@ -209,6 +245,24 @@ void TerminalEmulation::sendMouseEvent(int /*buttons*/, int /*column*/, int /*ro
     // default implementation does nothing
 }
 
+// returns the number of bytes of 'text' up to and including the first
+// ESC % sequence, which may switch the codec (ESC % G and ESC % @), or
+// 'length' if there is none.  the bytes of the sequence are plain ASCII,
+// which is encoded the same way by UTF-8 and the locale codecs
+static int codecSwitchLength(const char* text, int length)
+{
+    const char* end = text + length;
+    const char* escape = text;
+
+    while ((escape = static_cast<const char*>(memchr(escape, '\033', end - escape))) != 0)
+    {
+        if (end - escape >= 3 && escape[1] == '%')
+            return escape + 3 - text;
+        escape++;
+    }
+    return length;
+}
+
 /*
    We are doing code conversion from locale to unicode first.
 TODO: Character composition from the old code.  See #96536
@@ -218,13 +272,88 @@ void TerminalEmulation::receiveData(const char* text, int length)
 {
     emit stateSet(NOTIFYACTIVITY);
 
+    _outputStatistics.bytesReceived += length;
     bufferedUpdate();
 
-    QString unicodeText = _decoder->toUnicode(text,length);
+    while (length > 0)
+    {
+        // the lock is taken for a piece at a time, so that the windows
+        // do not wait for the whole of a large block to be processed
+        QMutexLocker locker(_snapshots.screenLock());
+
+        // the codec may be changed by the data itself, so each piece ends
+        // after a sequence which may switch it and the rest is decoded
+        // with the codec which is set then.  a sequence split across two
+        // reads takes effect from the next read
+        if (!utf8())
+        {
+            const int count = codecSwitchLength(text, length);
+            QString unicodeText = _decoder->toUnicode(text,count);
+
+            //send characters to terminal emulator
+            const QVector<uint> codePoints = unicodeText.toUcs4();
+            receiveChars(codePoints.constData(), codePoints.size());
+            text += count;
+            length -= count;
+            continue;
+        }
 
-    //send characters to terminal emulator
-    for (int i=0;i<unicodeText.length();i++)
-        receiveChar(unicodeText[i].unicode());
+        // one more than the bytes decoded, for a sequence left unfinished
+        // by the previous read, see Utf8Decoder::decode()
+        uint buffer[UTF8_CHUNK_LENGTH + 1];
+        const int count = codecSwitchLength(text, qMin(length, UTF8_CHUNK_LENGTH));
+        receiveChars(buffer, _utf8Decoder.decode(text, count, buffer));
+        text += count;
+        length -= count;
+    }
+}
+
+void TerminalEmulation::setReceiveQueue(ByteQueue* queue)
+{
+    if (_receiveQueue)
+        disconnect(_receiveQueue, 0, this, 0);
+
+    _receiveQueue = queue;
+
+    if (_receiveQueue)
+    {
+        connect(_receiveQueue, SIGNAL(dataAvailable()), this, SLOT(receiveQueuedData()),
+                Qt::QueuedConnection);
+
+        // pick up anything written before the queue was set
+        QMetaObject::invokeMethod(this, "receiveQueuedData", Qt::QueuedConnection);
+    }
+}
+
+void TerminalEmulation::receiveQueuedData()
+{
+    if (!_receiveQueue)
+        return;
+
+    char buffer[RECEIVE_CHUNK_LENGTH];
+    int received = 0;
+
+    while (received < RECEIVE_BUDGET)
+    {
+        const int length = _receiveQueue->read(buffer, RECEIVE_CHUNK_LENGTH);
+        if (length > 0)
+            receiveData(buffer, length);
+
+        // once the queue has been drained the next write emits dataAvailable()
+        if (length < RECEIVE_CHUNK_LENGTH)
+            return;
+
+        received += length;
+    }
+
+    // let the event loop handle input and painting before carrying on
+    QMetaObject::invokeMethod(this, "receiveQueuedData", Qt::QueuedConnection);
+}
+
+void TerminalEmulation::receiveChars(const uint* text, int length)
+{
+    for (int i=0;i<length;i++)
+        receiveChar(text[i]);
 }
 
 void TerminalEmulation::writeToStream( TerminalCharacterDecoder* _decoder ,
@@ -240,29 +369,81 @@ int TerminalEmulation::lineCount() const
     return _currentScreen->getLines() + _currentScreen->getHistLines();
 }
 
-#define BULK_TIMEOUT1 10
-#define BULK_TIMEOUT2 40
+void TerminalEmulation::collectExtendedChars()
+{
+    _extendedChars.beginGarbageCollection();
+    _screen[0]->markExtendedChars(_extendedChars);
+    _screen[1]->markExtendedChars(_extendedChars);
+    _extendedChars.endGarbageCollection();
+}
+
+void TerminalEmulation::takeSnapshot()
+{
+    {
+        QMutexLocker locker(_snapshots.screenLock());
+
+        if (_extendedChars.needsGarbageCollection())
+            collectExtendedChars();
+
+        _scrolledLines += _currentScreen->scrolledLines();
+        _droppedLines += _currentScreen->droppedLines();
+        _currentScreen->resetScrolledLines();
+        _currentScreen->resetDroppedLines();
+
+        ScreenSnapshot& snapshot = _snapshots.back();
+        snapshot.update(_currentScreen, _extendedChars);
+        snapshot.scrolledLines = _scrolledLines;
+        snapshot.droppedLines = _droppedLines;
+    }
+
+    _snapshots.publish();
+}
 
 void TerminalEmulation::showBulk()
 {
-    _bulkTimer1.stop();
-    _bulkTimer2.stop();
+    _frameTimer.stop();
+
+    // every display refresh after the first one that passed while the
+    // update was held back is a frame which was not shown
+    if (_pendingSince.isValid())
+    {
+        const qint64 waited = _pendingSince.elapsed() / _refreshInterval;
+        if (waited > 1)
+            _outputStatistics.framesDropped += waited - 1;
+        _pendingSince.invalidate();
+    }
+
+    QElapsedTimer cost;
+    cost.start();
+
+    takeSnapshot();
 
     emit outputChanged();
 
-    _currentScreen->resetScrolledLines();
-    _currentScreen->resetDroppedLines();
+    _outputStatistics.framesEmitted++;
+    _lastFrame.start();
+
+    // if the update takes more than a refresh, leave as much time again
+    // before the next one so that input keeps being processed in between,
+    // otherwise follow the display.  views on another thread are not
+    // waited for, they pick up the latest snapshot when they get to it
+    _frameInterval = qBound(_refreshInterval, int(cost.elapsed()) * 2, MAX_FRAME_INTERVAL);
 }
 
 void TerminalEmulation::bufferedUpdate()
 {
-    _bulkTimer1.setSingleShot(true);
-    _bulkTimer1.start(BULK_TIMEOUT1);
-    if (!_bulkTimer2.isActive())
-    {
-        _bulkTimer2.setSingleShot(true);
-        _bulkTimer2.start(BULK_TIMEOUT2);
-    }
+    if (_frameTimer.isActive())
+        return;
+
+    if (!_pendingSince.isValid())
+        _pendingSince.start();
+
+    // an update after a quiet period is shown right away, updates
+    // arriving faster than that are collected into the next frame
+    qint64 delay = 0;
+    if (_lastFrame.isValid())
+        delay = qMax(Q_INT64_C(0), _frameInterval - _lastFrame.elapsed());
+    _frameTimer.start(int(delay));
 }
 
 char TerminalEmulation::eraseChar() const
@@ -284,8 +465,11 @@ void TerminalEmulation::setImageSize(int lines, int columns)
     if (newSize == screenSize[0] && newSize == screenSize[1])
         return;
 
-    _screen[0]->resizeImage(lines,columns);
-    _screen[1]->resizeImage(lines,columns);
+    {
+        QMutexLocker locker(_snapshots.screenLock());
+        _screen[0]->resizeImage(lines,columns);
+        _screen[1]->resizeImage(lines,columns);
+    }
 
     emit imageSizeChanged(lines,columns);
 
@@ -297,101 +481,75 @@ QSize TerminalEmulation::imageSize() const
     return QSize(_currentScreen->getColumns(), _currentScreen->getLines());
 }
 
-ushort ExtendedCharTable::extendedCharHash(ushort* unicodePoints , ushort length) const
+ExtendedCharTable::ExtendedCharTable()
+    : _entries(1)
+    , _generation(0)
+    , _collections(0)
+    , _liveCount(0)
+    , _collectThreshold(MIN_COLLECT_THRESHOLD)
 {
-    ushort hash = 0;
-    for ( ushort i = 0 ; i < length ; i++ )
-    {
-        hash = 31*hash + unicodePoints[i];
-    }
-    return hash;
 }
-bool ExtendedCharTable::extendedCharMatch(ushort hash , ushort* unicodePoints , ushort length) const
-{
-    ushort* entry = extendedCharTable[hash];
 
-    // compare given length with stored sequence length ( given as the first ushort in the
-    // stored buffer )
-    if ( entry == 0 || entry[0] != length )
-        return false;
-    // if the lengths match, each character must be checked.  the stored buffer starts at
-    // entry[1]
-    for ( int i = 0 ; i < length ; i++ )
-    {
-        if ( entry[i+1] != unicodePoints[i] )
-            return false;
-    }
-    return true;
-}
-ushort ExtendedCharTable::createExtendedChar(ushort* unicodePoints , ushort length)
+uint ExtendedCharTable::createExtendedChar(const uint* unicodePoints , int length)
 {
-    // look for this sequence of points in the table
-    ushort hash = extendedCharHash(unicodePoints,length);
-
-    // check existing entry for match
-    while ( extendedCharTable.contains(hash) )
-    {
-        if ( extendedCharMatch(hash,unicodePoints,length) )
-        {
-            // this sequence already has an entry in the table,
-            // return its hash
-            return hash;
-        }
-        else
-        {
-            // if hash is already used by another, different sequence of unicode character
-            // points then try next hash
-            hash++;
-        }
-    }
-
-    
-    // add the new sequence to the table and
-    // return that index
-    ushort* buffer = new ushort[length+1];
-    buffer[0] = length;
-    for ( int i = 0 ; i < length ; i++ )
-        buffer[i+1] = unicodePoints[i];
-    
-    extendedCharTable.insert(hash,buffer);
+    if (length > MaxSequenceLength)
+        return InvalidKey;
 
-    return hash;
-}
+    QVector<uint> sequence(length);
+    memcpy(sequence.data(), unicodePoints, length * sizeof(uint));
 
-ushort* ExtendedCharTable::lookupExtendedChar(ushort hash , ushort& length) const
-{
-    // lookup index in table and if found, set the length
-    // argument and return a pointer to the character sequence
+    // this sequence already has an entry in the table, return its key
+    QHash<QVector<uint>,uint>::const_iterator existing = _keys.constFind(sequence);
+    if (existing != _keys.constEnd())
+        return existing.value();
 
-    ushort* buffer = extendedCharTable[hash];
-    if ( buffer )
+    uint key;
+    if (!_freeKeys.isEmpty())
     {
-        length = buffer[0];
-        return buffer+1;
+        key = _freeKeys.last();
+        _freeKeys.removeLast();
     }
     else
     {
-        length = 0;
-        return 0;
+        // the key has to fit into Character::character
+        if (_entries.size() > MAX_EXTENDED_CHAR_KEY)
+            return InvalidKey;
+        key = _entries.size();
+        _entries.resize(key + 1);
     }
-}
 
-ExtendedCharTable::ExtendedCharTable()
-{
+    Entry& entry = _entries[key];
+    entry.sequence = sequence;
+    entry.generation = _generation;
+    _keys.insert(sequence, key);
+    _liveCount++;
+
+    return key;
 }
-ExtendedCharTable::~ExtendedCharTable()
+
+void ExtendedCharTable::endGarbageCollection()
 {
-    // free all allocated character buffers
-    QHashIterator<ushort,ushort*> iter(extendedCharTable);
-    while ( iter.hasNext() )
+    const int liveCount = _liveCount;
+
+    for (int key = 1; key < _entries.size(); key++)
     {
-        iter.next();
-        delete[] iter.value();
+        Entry& entry = _entries[key];
+        if (entry.sequence.isEmpty() || entry.generation == _generation)
+            continue;
+
+        _keys.remove(entry.sequence);
+        entry.sequence = QVector<uint>();
+        _freeKeys.append(key);
+        _liveCount--;
     }
-}
 
-// global instance
-ExtendedCharTable ExtendedCharTable::instance;
+    if (_liveCount != liveCount)
+        _collections++;
+
+    // collect again once the table has doubled in size, so that the cost of
+    // marking the screens and history is spread over the sequences added
+    _collectThreshold = qMax(MIN_COLLECT_THRESHOLD, _liveCount * 2);
+}
 
 
 //#include "Emulation.moc"
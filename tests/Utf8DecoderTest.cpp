@@ -0,0 +1,98 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own includes
+#include "../Utf8Decoder.h"
+
+// Qt includes
+#include <QtTest>
+
+// the number of bytes TerminalEmulation::receiveData() decodes at a time
+static const int ChunkLength = 1024;
+// marks the entries of an output buffer which decode() has not written
+static const uint Unwritten = 0xdeadbeef;
+
+class Utf8DecoderTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void decodesAscii();
+    void decodesSequenceSplitAcrossCalls();
+    void replacesMalformedBytes();
+    void pendingSequenceBeforeFullChunk();
+};
+
+void Utf8DecoderTest::decodesAscii()
+{
+    Utf8Decoder decoder;
+    uint output[16 + 1];
+    const int count = decoder.decode("hello, terminal!", 16, output);
+
+    QCOMPARE(count, 16);
+    QCOMPARE(output[0], uint('h'));
+    QCOMPARE(output[15], uint('!'));
+}
+
+void Utf8DecoderTest::decodesSequenceSplitAcrossCalls()
+{
+    // U+20AC EURO SIGN, split after its first byte
+    Utf8Decoder decoder;
+    uint output[2 + 1];
+
+    QCOMPARE(decoder.decode("\xe2", 1, output), 0);
+    QCOMPARE(decoder.decode("\x82\xac", 2, output), 1);
+    QCOMPARE(output[0], uint(0x20ac));
+}
+
+void Utf8DecoderTest::replacesMalformedBytes()
+{
+    // a stray continuation byte, an overlong encoding of '/' and a surrogate
+    Utf8Decoder decoder;
+    uint output[6 + 1];
+    const int count = decoder.decode("\x80\xc0\xaf\xed\xa0\x80", 6, output);
+
+    QCOMPARE(count, 4);
+    for (int i = 0; i < count; i++)
+        QCOMPARE(output[i], uint(0xfffd));
+}
+
+void Utf8DecoderTest::pendingSequenceBeforeFullChunk()
+{
+    // a sequence left unfinished at the end of one read, followed by a full
+    // chunk which does not continue it, gives one more code point than the
+    // chunk has bytes
+    Utf8Decoder decoder;
+    uint output[ChunkLength + 2];
+    for (int i = 0; i < ChunkLength + 2; i++)
+        output[i] = Unwritten;
+
+    QCOMPARE(decoder.decode("\xe2", 1, output), 0);
+
+    const QByteArray chunk(ChunkLength, 'A');
+    const int count = decoder.decode(chunk.constData(), chunk.length(), output);
+
+    QCOMPARE(count, ChunkLength + 1);
+    QCOMPARE(output[0], uint(0xfffd));
+    QCOMPARE(output[1], uint('A'));
+    QCOMPARE(output[ChunkLength], uint('A'));
+    QCOMPARE(output[ChunkLength + 1], Unwritten);
+}
+
+QTEST_APPLESS_MAIN(Utf8DecoderTest)
+
+#include "Utf8DecoderTest.moc"
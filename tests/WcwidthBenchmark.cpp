@@ -0,0 +1,127 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Checks konsole_wcwidth() against a binary search in the interval tables
+// it was generated from, and compares the speed of both.  Built separately
+// from the application:
+//   qmake wcwidthbenchmark.pro && make && ./WcwidthBenchmark
+
+// Own includes
+#include "../konsole_wcwidth.h"
+#include "wcwidth_intervals.h"
+
+// System includes
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// number of times each set of characters is looked up
+#define ROUNDS 20
+
+static bool bisearch(uint ucs, const struct interval* table, int count)
+{
+    int min = 0;
+    int max = count - 1;
+
+    if (ucs < table[0].first || ucs > table[max].last)
+        return false;
+
+    while (max >= min)
+    {
+        const int mid = (min + max) / 2;
+        if (ucs > table[mid].last)
+            min = mid + 1;
+        else if (ucs < table[mid].first)
+            max = mid - 1;
+        else
+            return true;
+    }
+    return false;
+}
+
+// the interval implementation konsole_wcwidth() replaced
+static int intervalWidth(uint ucs)
+{
+    if (ucs == 0)
+        return 0;
+    if (ucs < 32 || (ucs >= 0x7f && ucs < 0xa0))
+        return -1;
+    if (bisearch(ucs, combining, sizeof(combining) / sizeof(combining[0])))
+        return 0;
+    return 1 + bisearch(ucs, wide, sizeof(wide) / sizeof(wide[0]));
+}
+
+// returns the time in ns per lookup of 'width' over 'text'
+template <typename Width>
+static double measure(Width width, const std::vector<uint>& text, long& sum)
+{
+    const auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        for (uint c : text)
+            sum += width(c);
+    }
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (double(ROUNDS) * text.size());
+}
+
+int main()
+{
+    for (uint c = 0; c < 0x110000; c++)
+    {
+        if (konsole_wcwidth(c) != intervalWidth(c))
+        {
+            printf("U+%04X: table %d, intervals %d\n", c, konsole_wcwidth(c), intervalWidth(c));
+            return 1;
+        }
+    }
+    printf("all code points have the same width in both implementations\n\n");
+
+    // the mixed set is Latin, Cyrillic, emoji and combining marks
+    std::mt19937 random(1);
+    std::vector<uint> ascii(1 << 20), cjk(1 << 20), mixed(1 << 20);
+    for (uint& c : ascii)
+        c = 0x20 + random() % 95;
+    for (uint& c : cjk)
+        c = 0x4e00 + random() % 0x5000;
+    for (uint& c : mixed)
+    {
+        switch (random() % 4)
+        {
+        case 0: c = 0x20 + random() % 95; break;
+        case 1: c = 0x400 + random() % 0x300; break;
+        case 2: c = 0x1f300 + random() % 0x300; break;
+        default: c = 0x300 + random() % 0x70; break;
+        }
+    }
+
+    const char* names[] = { "ASCII", "CJK", "mixed" };
+    const std::vector<uint>* sets[] = { &ascii, &cjk, &mixed };
+
+    long sum = 0;
+    printf("set     bisearch   table      speedup\n");
+    for (int i = 0; i < 3; i++)
+    {
+        const double before = measure(intervalWidth, *sets[i], sum);
+        const double after = measure([](uint c) { return konsole_wcwidth(c); }, *sets[i], sum);
+        printf("%-6s  %5.1f ns    %5.1f ns    %.1fx\n", names[i], before, after, before / after);
+    }
+
+    // keeps the lookups from being optimized away
+    return sum == 42 ? 2 : 0;
+}
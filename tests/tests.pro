@@ -0,0 +1,19 @@
+#-------------------------------------------------
+#
+# Unit tests, built separately from the application:
+#   qmake tests.pro && make && ./Utf8DecoderTest
+#
+#-------------------------------------------------
+
+QT       += core testlib
+QT       -= gui
+
+TARGET = Utf8DecoderTest
+TEMPLATE = app
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+SOURCES += Utf8DecoderTest.cpp \
+           ../Utf8Decoder.cpp
+
+HEADERS += ../Utf8Decoder.h
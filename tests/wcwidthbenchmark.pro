@@ -0,0 +1,20 @@
+#-------------------------------------------------
+#
+# Benchmark of konsole_wcwidth(), built separately from the application:
+#   qmake wcwidthbenchmark.pro && make && ./WcwidthBenchmark
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+TARGET = WcwidthBenchmark
+TEMPLATE = app
+CONFIG += c++11 console release
+CONFIG -= app_bundle
+
+SOURCES += WcwidthBenchmark.cpp \
+           ../konsole_wcwidth.cpp
+
+HEADERS += ../konsole_wcwidth.h \
+           wcwidth_intervals.h